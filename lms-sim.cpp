@@ -0,0 +1,164 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Fake Logitech Media Server for hardware-free end-to-end runs. Start it, then point
+// sonos-squeezebox at it with --server=127.0.0.1:3483. Once the player connects the script is
+// executed and the latency from each command to the player's acknowledgement is reported.
+//
+//   ./lms-sim --file=a.flac,b.mp3,c.wav [--rate=kbit/s] [--slim-port=3483] [--http-port=9000]
+//             [--script=play:0,wait:10,pause,wait:2,unpause,wait:5,skip:1,wait:5,stop]
+//
+// Without --script every track is played, paused, unpaused and skipped in turn. Times are also
+// printed as wall-clock milliseconds so they can be matched with the Sonos side (sonos-sim).
+
+#include "sbslimserver.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+#define ACK_TIMEOUT_MS 15000
+
+static const char* getCmdOption(int argc, char** argv, const std::string& option);
+
+static std::vector<std::string> split(const std::string& str, char sep)
+{
+    std::vector<std::string> list;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, sep)) {
+        if (!item.empty()) {
+            list.push_back(item);
+        }
+    }
+    return list;
+}
+
+static unsigned long long wallMs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return (unsigned long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+int main(int argc, char** argv)
+{
+    const char* files = getCmdOption(argc, argv, "--file");
+    const char* rate = getCmdOption(argc, argv, "--rate");
+    const char* slimPort = getCmdOption(argc, argv, "--slim-port");
+    const char* httpPort = getCmdOption(argc, argv, "--http-port");
+    const char* script = getCmdOption(argc, argv, "--script");
+
+    if (!files) {
+        printf("Please specify the tracks to serve with the --file option\n");
+        return EXIT_FAILURE;
+    }
+
+    SlimServerSim server(slimPort ? atoi(slimPort) : 3483, httpPort ? atoi(httpPort) : 9000);
+    std::vector<std::string> tracks = split(files, ',');
+    for (const std::string& t : tracks) {
+        server.addTrack(t);
+    }
+    server.setRate(rate ? atoi(rate) : 0);
+
+    std::string steps;
+    if (script) {
+        steps = script;
+    } else {
+        for (size_t i = 0; i < tracks.size(); ++i) {
+            steps += "play:" + std::to_string(i) + ",wait:8,pause,wait:2,unpause,wait:4,skip:"
+                + std::to_string((i + 1) % tracks.size()) + ",wait:4,stop,wait:2,";
+        }
+    }
+
+    if (!server.start()) {
+        return EXIT_FAILURE;
+    }
+    printf("lms-sim: waiting for player ... ");
+    fflush(stdout);
+    if (!server.waitForPlayer(120000)) {
+        printf("no player connected\n");
+        return EXIT_FAILURE;
+    }
+    printf("%s connected\n\n", server.playerMac().c_str());
+
+    printf("+------------------------------------------------------------------------+\n");
+    printf("| %-10s | %-6s | %-5s | %-6s | %12s | %-16s |\n", "command", "codec", "track", "ack", "latency ms", "sent (wall ms)");
+    printf("+------------------------------------------------------------------------+\n");
+    int failed = 0;
+    int current = -1;
+    for (const std::string& step : split(steps, ',')) {
+        std::string cmd = step.substr(0, step.find(':'));
+        int arg = step.find(':') != std::string::npos ? atoi(step.substr(step.find(':') + 1).c_str()) : 0;
+        unsigned long long wall = wallMs();
+        uint64_t sent;
+        const char* ack;
+        if (cmd == "wait") {
+            sleep(arg);
+            continue;
+        } else if (cmd == "play") {
+            sent = server.play(current = arg);
+            ack = "STMs";
+        } else if (cmd == "pause") {
+            sent = server.pause();
+            ack = "STMp";
+        } else if (cmd == "unpause") {
+            sent = server.unpause();
+            ack = "STMr";
+        } else if (cmd == "skip") {
+            sent = server.skip(current = arg);
+            ack = "STMs";
+        } else if (cmd == "stop") {
+            sent = server.stopPlayback();
+            ack = "STMf";
+        } else {
+            printf("lms-sim: unknown command %s\n", cmd.c_str());
+            return EXIT_FAILURE;
+        }
+        uint64_t at = server.waitForEvent(ack, sent, ACK_TIMEOUT_MS);
+        const char* codec = current >= 0 ? server.trackCodec(current).c_str() : "-";
+        if (at) {
+            printf("| %-10s | %-6s | %5d | %-6s | %12.1f | %16llu |\n", cmd.c_str(), codec, current, ack, (at - sent) / 1000.0, wall);
+        } else {
+            printf("| %-10s | %-6s | %5d | %-6s | %12s | %16llu |\n", cmd.c_str(), codec, current, ack, "timeout", wall);
+            ++failed;
+        }
+        fflush(stdout);
+    }
+    printf("+------------------------------------------------------------------------+\n");
+    server.stop();
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static const char* getCmdOption(int argc, char** argv, const std::string& option)
+{
+    char** end = argv + argc;
+    for (char** it = argv; it != end; ++it) {
+        if (strncmp(*it, option.c_str(), option.length()) == 0 && (*it)[option.length()] == '=')
+            return &((*it)[option.length() + 1]);
+    }
+    return NULL;
+}
@@ -0,0 +1,101 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "metricsbroker.h"
+
+#include "sbmetrics.h"
+
+#include <cstring>
+
+#define METRICSBROKER_CONTENT "text/plain; version=0.0.4"
+
+using namespace NSROOT;
+
+MetricsBroker::MetricsBroker()
+    : RequestBroker()
+    , m_resources()
+{
+    ResourcePtr ptr = ResourcePtr(new Resource());
+    ptr->uri = METRICSBROKER_URI;
+    ptr->title = METRICSBROKER_CNAME;
+    ptr->description = "Prometheus metrics";
+    ptr->contentType = METRICSBROKER_CONTENT;
+    m_resources.push_back(ptr);
+}
+
+bool MetricsBroker::HandleRequest(handle* handle)
+{
+    if (!IsAborted()) {
+        const std::string& requrl = RequestBroker::GetRequestURI(handle);
+        if (requrl.compare(0, strlen(METRICSBROKER_URI), METRICSBROKER_URI) == 0) {
+            switch (RequestBroker::GetRequestMethod(handle)) {
+            case RequestBroker::Method_GET:
+            case RequestBroker::Method_HEAD: {
+                std::string body = sbmetrics_render();
+                std::string resp;
+                resp.assign(RequestBroker::MakeResponseHeader(RequestBroker::Status_OK))
+                    .append("Content-Type: " METRICSBROKER_CONTENT "\r\n")
+                    .append("Content-Length: ")
+                    .append(std::to_string(body.length()))
+                    .append("\r\n\r\n");
+                if (RequestBroker::GetRequestMethod(handle) == RequestBroker::Method_GET) {
+                    resp.append(body);
+                }
+                RequestBroker::Reply(handle, resp.c_str(), resp.length());
+                return true;
+            }
+            default:
+                return false; // unhandled method
+            }
+        }
+    }
+    return false;
+}
+
+RequestBroker::ResourcePtr MetricsBroker::GetResource(const std::string& title)
+{
+    (void)title;
+    return m_resources.front();
+}
+
+RequestBroker::ResourceList MetricsBroker::GetResourceList()
+{
+    ResourceList list;
+    for (ResourceList::iterator it = m_resources.begin(); it != m_resources.end(); ++it)
+        list.push_back((*it));
+    return list;
+}
+
+RequestBroker::ResourcePtr MetricsBroker::RegisterResource(const std::string& title,
+    const std::string& description,
+    const std::string& path,
+    StreamReader* delegate)
+{
+    (void)title;
+    (void)description;
+    (void)path;
+    (void)delegate;
+    return ResourcePtr();
+}
+
+void MetricsBroker::UnregisterResource(const std::string& uri)
+{
+    (void)uri;
+}
@@ -19,12 +19,16 @@
 
 #include "squeezelite.h"
 #include "output_sonos.h"
+#include "sbbudget.h"
+#include "sbmetrics.h"
+#include "sbsched.h"
+#include "sbtrace.h"
 
 #if BYTES_PER_FRAME != 8
 #error BYTES_PER_FRAME not 8 bytes
 #endif
 
-#define FRAME_BLOCK MAX_SILENCE_FRAMES
+#define FRAME_BLOCK MAX_SILENCE_FRAMES // at most, the profile may ask for less
 
 static log_level loglevel;
 
@@ -32,24 +36,66 @@ static bool running = true;
 
 extern struct outputstate output;
 extern struct buffer* outputbuf;
+extern struct buffer* streambuf;
 
 #define LOCK mutex_lock(outputbuf->mutex)
 #define UNLOCK mutex_unlock(outputbuf->mutex)
 
 void encode_squeezebox_audio(const char* data, int len);
 void close_squeezebox_audio();
+int32_t squeezebox_lead_ms(void);
+void sync_squeezebox_volume(unsigned left, unsigned right);
 
 static u8_t* buf;
 static unsigned buffill;
 static int bytes_per_frame;
+static unsigned frame_block = FRAME_BLOCK;
 static unsigned squeezebox_stream_id = 0;
 
 static bool silent = true;
+static u32_t silent_since = 0; // gettime_ms(), or when buffer memory was last looked at
+static bool released = false;
+
+// A flush (skip, seek or stop) with more audio queued than this moves to a new stream right away,
+// instead of letting Sonos play the queued audio first. The new stream outlives the silence that
+// follows the flush by FLUSH_GRACE_MS, long enough for the next track to start (0 = no grace).
+#define FLUSH_GRACE_MS 5000
+static unsigned skip_restart_ms = 500;
+static u32_t flush_grace_until = 0;
+static unsigned frames_played_last = 0;
+
+// A stream taken over from a previous process (see sbhandover.h) is fed silence until LMS sends
+// audio again, for at most TAKEOVER_GRACE_MS, so Sonos keeps playing it instead of running dry.
+#define TAKEOVER_GRACE_MS 30000
+static bool pad_silence = false;
+
+void set_skip_restart_ms(unsigned ms)
+{
+    skip_restart_ms = ms;
+}
+
+// Before squeezelite starts: the output thread does not run yet.
+void adopt_squeezebox_stream(unsigned id, bool playing)
+{
+    squeezebox_stream_id = id;
+    sbmetrics_set(SBM_STREAM_ID, squeezebox_stream_id);
+    if (playing) {
+        silent = false;
+        pad_silence = true;
+        flush_grace_until = gettime_ms() + TAKEOVER_GRACE_MS;
+        if (!flush_grace_until) {
+            flush_grace_until = 1;
+        }
+    }
+}
 
 void new_squeezebox_stream_id(void)
 {
     ++squeezebox_stream_id;
-    printf("Creating new stream (%u) for Sonos\n", squeezebox_stream_id);
+    sbmetrics_add(SBM_STREAM_STARTS, 1);
+    sbmetrics_set(SBM_STREAM_ID, squeezebox_stream_id);
+    sbtrace(SBT_STREAM_NEW, squeezebox_stream_id, squeezebox_stream_id, 0);
+    sbmetrics_start_phase(SBP_STREAM_ID, squeezebox_stream_id);
 }
 
 unsigned get_squeezebox_stream_id(void)
@@ -66,23 +112,41 @@ static int _sonos_write_frames(frames_t out_frames, bool silence, s32_t gainL, s
     if (!silence) {
 
         if (silent) {
-            printf("From silent to non-silent\n");
+            sbtrace(SBT_SILENT_TO_AUDIO, squeezebox_stream_id, 0, 0);
+            sbmetrics_start_phase(SBP_AUDIO, 0);
             new_squeezebox_stream_id();
             silent = false;
+            released = false;
         }
 
         if (output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS && *cross_ptr) {
             _apply_cross(outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
         }
 
+        flush_grace_until = 0;
+        pad_silence = false;
         obuf = outputbuf->readp;
 
     } else {
 
+        if (!silent && flush_grace_until) {
+            if ((s32_t)(output.updated - flush_grace_until) < 0) {
+                if (pad_silence) {
+                    memset(buf + buffill * bytes_per_frame, 0, out_frames * bytes_per_frame);
+                    buffill += out_frames;
+                    return (int)out_frames;
+                }
+                return 0; // flushed, waiting for the next track on the new stream
+            }
+            flush_grace_until = 0;
+            pad_silence = false;
+        }
+
         if (!silent) {
-            printf("From non-silent to silent\n");
+            sbtrace(SBT_AUDIO_TO_SILENT, squeezebox_stream_id, 0, 0);
             close_squeezebox_audio();
             silent = true;
+            silent_since = gettime_ms();
         }
 
         return 0; // no silence output
@@ -96,6 +160,17 @@ static int _sonos_write_frames(frames_t out_frames, bool silence, s32_t gainL, s
     return (int)out_frames;
 }
 
+// Moves playing audio to a new stream, so a (new) coordinator requests it from the start.
+void restart_squeezebox_stream(void)
+{
+    LOCK;
+    if (!silent) {
+        sbmetrics_start_phase(SBP_AUDIO, 0);
+        new_squeezebox_stream_id();
+    }
+    UNLOCK;
+}
+
 uint32_t get_sb_time_ms(void)
 {
     uint32_t res = gettime_ms();
@@ -105,23 +180,97 @@ uint32_t get_sb_time_ms(void)
     return 0;
 }
 
+#define COUNTER_INTERVAL_MS 100
+
+// squeezelite flushes the output buffer on a skip, seek or stop: the output is stopped and the
+// played frames are reset, which a pause does not do. Called with the output buffer locked.
+static void check_flush(void)
+{
+    bool flushed = output.state == OUTPUT_STOPPED && output.frames_played == 0 && frames_played_last != 0;
+    frames_played_last = output.frames_played;
+    if (!flushed || silent) {
+        return;
+    }
+    int32_t lead = squeezebox_lead_ms();
+    bool restart = skip_restart_ms && lead > (int32_t)skip_restart_ms;
+    sbmetrics_skip_flush(squeezebox_stream_id);
+    if (restart) {
+        // the encoder of the old stream stops on the new id and its queued audio is dropped
+        sbmetrics_start_phase(SBP_AUDIO, 0);
+        new_squeezebox_stream_id();
+        sbmetrics_add(SBM_SKIP_RESTARTS, 1);
+        flush_grace_until = output.updated + FLUSH_GRACE_MS;
+        if (!flush_grace_until) {
+            flush_grace_until = 1;
+        }
+    }
+    sbtrace(SBT_FLUSH, squeezebox_stream_id, lead, restart ? squeezebox_stream_id : 0);
+}
+
+// Gives the pages of the squeezelite buffers back to the OS once they are empty. While paused they
+// still hold audio and are kept. Lock order as in the decoder: stream buffer, then output buffer.
+static bool release_idle_buffers(void)
+{
+    bool empty;
+    mutex_lock(streambuf->mutex);
+    LOCK;
+    empty = !_buf_used(streambuf) && !_buf_used(outputbuf);
+    if (empty) {
+        sbbudget_release(streambuf->buf, streambuf->size);
+        sbbudget_release(outputbuf->buf, outputbuf->size);
+    }
+    UNLOCK;
+    mutex_unlock(streambuf->mutex);
+    if (empty) {
+        sbbudget_trim();
+        sbmetrics_add(SBM_IDLE_RELEASES, 1);
+    }
+    return empty;
+}
+
 static void* output_thread()
 {
+    u32_t counted = 0;
+
+    sbsched_apply(SBR_OUTPUT);
+
     while (running) {
 
+        uint64_t t = sbtrace_begin();
+
         LOCK;
         output.device_frames = 0;
         output.updated = gettime_ms();
         output.frames_played_dmp = output.frames_played;
-        _output_frames(FRAME_BLOCK);
+        check_flush();
+        _output_frames(frame_block);
+        if (output.updated - counted >= COUNTER_INTERVAL_MS) {
+            // the stream buffer is sampled without taking its lock, the value is only indicative
+            unsigned out_used = _buf_used(outputbuf);
+            unsigned stream_used = _buf_used(streambuf);
+            counted = output.updated;
+            sbmetrics_set(SBM_OUTPUTBUF_BYTES, out_used);
+            sbmetrics_set(SBM_STREAMBUF_BYTES, stream_used);
+            if (!silent) {
+                sbmetrics_set(SBM_PIPELINE_MS, (int64_t)out_used * 1000 / (44100 * BYTES_PER_FRAME) + sbmetrics_get(SBM_LEAD_MS));
+            }
+            sbtrace_count(SBC_OUTPUTBUF, squeezebox_stream_id, out_used);
+            sbtrace_count(SBC_STREAMBUF, squeezebox_stream_id, stream_used);
+        }
         UNLOCK;
 
         if (buffill) {
+            sbtrace_end(SBS_OUTPUT_FRAMES, squeezebox_stream_id, t, buffill);
             encode_squeezebox_audio((const char*)buf, buffill * bytes_per_frame);
             buffill = 0;
         }
 
-        usleep(10);
+        if (silent && !released && output.updated - silent_since >= SBBUDGET_IDLE_MS) {
+            released = release_idle_buffers();
+            silent_since = output.updated; // not empty: look again after another idle period
+        }
+
+        sbsched_sleep_us(SBR_OUTPUT, 10);
     }
 
     return 0;
@@ -141,11 +290,14 @@ void output_init_sonos(log_level level, unsigned output_buf_size, char* params,
         return;
     }
     buffill = 0;
+    if (sbbudget_get()->output_frames && sbbudget_get()->output_frames < FRAME_BLOCK) {
+        frame_block = sbbudget_get()->output_frames;
+    }
 
     memset(&output, 0, sizeof(output));
 
     output.format = S16_LE;
-    output.start_frames = FRAME_BLOCK * 2;
+    output.start_frames = frame_block * 2;
     output.write_cb = &_sonos_write_frames;
     output.rate_delay = rate_delay;
 
@@ -197,5 +349,5 @@ bool test_open(const char* device, unsigned rates[], bool userdef_rates)
 
 void set_volume(unsigned left, unsigned right)
 {
-    // printf("SONOS: set_volume(%d, %d)\n", left, right);
+    sync_squeezebox_volume(left, right);
 }
@@ -24,5 +24,8 @@ void output_init_sonos(log_level level, unsigned output_buf_size, char* params,
 void output_close_sonos(void);
 void new_squeezebox_stream_id(void);
 unsigned get_squeezebox_stream_id(void);
+void restart_squeezebox_stream(void);
+void set_skip_restart_ms(unsigned ms);
+void adopt_squeezebox_stream(unsigned id, bool playing);
 
 #endif /* OUTPUT_SONOS_H */
@@ -0,0 +1,131 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "sbbudget.h"
+#include "sbring.h"
+
+#include <cstdio>
+#include <cstring>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+// until configured: FLAC, which produces PCM rates at worst
+struct sbbudget g_budget = { 0, 0, 0, SBBUDGET_QUEUE_MS * SBBUDGET_PCM_IN_BYTES_PER_S / 1000, 16384, SBBUDGET_LEAD_MS, 0, 0 };
+bool g_lowlatency = false;
+
+size_t fixedBytes(void)
+{
+    return (size_t)g_budget.ring_bytes + g_budget.http_chunk;
+}
+
+} // namespace
+
+extern "C" {
+
+int sbbudget_profile(const char* name)
+{
+    if (strcmp(name, "default") == 0) {
+        g_lowlatency = false;
+    } else if (strcmp(name, "lowlatency") == 0) {
+        g_lowlatency = true;
+    } else {
+        return 0;
+    }
+    g_budget.lead_ms = g_lowlatency ? SBBUDGET_LOWLATENCY_LEAD_MS : SBBUDGET_LEAD_MS;
+    g_budget.block_frames = g_lowlatency ? SBBUDGET_LOWLATENCY_BLOCK : 0;
+    g_budget.output_frames = g_lowlatency ? SBBUDGET_LOWLATENCY_BLOCK : 0;
+    return 1;
+}
+
+int sbbudget_configure(unsigned latency_ms, unsigned budget_kb, unsigned typical_bytes_per_s, unsigned max_bytes_per_s)
+{
+    unsigned chunk = typical_bytes_per_s * 3 / 20 / 4096 * 4096; // about 150 ms per chunk
+    g_budget.http_chunk = chunk < 4096 ? 4096 : chunk > 16384 ? 16384 : chunk;
+    if (g_lowlatency) {
+        g_budget.http_chunk = SBBUDGET_LOWLATENCY_CHUNK;
+    }
+    g_budget.ring_bytes = (unsigned)((uint64_t)SBBUDGET_QUEUE_MS * max_bytes_per_s / 1000);
+    if (!latency_ms && !budget_kb) {
+        return 1;
+    }
+    if (budget_kb) {
+        size_t budget = (size_t)budget_kb * 1024;
+        size_t fixed = fixedBytes();
+        size_t perS = SBBUDGET_PCM_IN_BYTES_PER_S + SBBUDGET_PCM_OUT_BYTES_PER_S;
+        unsigned fits = budget > fixed ? (unsigned)((budget - fixed) * 1000 / perS) : 0;
+        if (fits < SBBUDGET_MIN_LATENCY_MS) {
+            return 0;
+        }
+        if (!latency_ms || latency_ms > fits) {
+            latency_ms = fits;
+        }
+    }
+    if (latency_ms < SBBUDGET_MIN_LATENCY_MS) {
+        latency_ms = SBBUDGET_MIN_LATENCY_MS;
+    }
+    g_budget.latency_ms = latency_ms;
+    g_budget.streambuf_size = (unsigned)((uint64_t)latency_ms * SBBUDGET_PCM_IN_BYTES_PER_S / 1000);
+    g_budget.outputbuf_size = (unsigned)((uint64_t)latency_ms * SBBUDGET_PCM_OUT_BYTES_PER_S / 1000);
+    return 1;
+}
+
+const struct sbbudget* sbbudget_get(void)
+{
+    return &g_budget;
+}
+
+size_t sbbudget_bytes(void)
+{
+    return g_budget.streambuf_size + g_budget.outputbuf_size + fixedBytes();
+}
+
+void sbbudget_release(void* buf, size_t size)
+{
+    // Only whole pages inside the buffer; the squeezelite buffers are large enough to be mappings
+    // of their own. Fails harmlessly (EINVAL) on memory locked with --mlock.
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t)buf + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)buf + size) & ~(page - 1);
+    if (end > begin) {
+        madvise((void*)begin, end - begin, MADV_DONTNEED);
+    }
+}
+
+void sbbudget_trim(void)
+{
+    NSROOT::SBRing::trim();
+    malloc_trim(0);
+}
+
+int64_t sbbudget_rss_bytes(void)
+{
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    long long size = 0, resident = 0;
+    int n = fscanf(f, "%lld %lld", &size, &resident);
+    fclose(f);
+    return n == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+} // extern "C"
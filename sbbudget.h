@@ -0,0 +1,72 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SBBUDGET_H
+#define SBBUDGET_H
+
+// Buffer sizes of one room. By default squeezelite's own sizes are used; with a target latency or
+// a memory budget the buffers are sized to hold that much audio instead. A profile sets how far
+// the encoder runs ahead and in what portions audio moves through the pipeline.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SBBUDGET_PCM_IN_BYTES_PER_S (44100 * 4) // 16-bit stereo, the largest input at 44.1 kHz
+#define SBBUDGET_PCM_OUT_BYTES_PER_S (44100 * 8) // squeezelite keeps 32-bit samples for output
+#define SBBUDGET_QUEUE_MS 7000 // encoded audio queued at most: 2 s lead and 5 s of stall
+#define SBBUDGET_MIN_LATENCY_MS 500
+#define SBBUDGET_IDLE_MS 30000 // silence after which buffer memory is given back
+#define SBBUDGET_LEAD_MS 2000 // audio encoded ahead of what Sonos played
+
+// lowlatency profile: 23 ms FLAC blocks and output portions, 4 KB chunks
+#define SBBUDGET_LOWLATENCY_LEAD_MS 500
+#define SBBUDGET_LOWLATENCY_BLOCK 1024
+#define SBBUDGET_LOWLATENCY_CHUNK 4096
+
+struct sbbudget {
+    unsigned latency_ms; // audio the squeezelite buffers hold, 0 = squeezelite defaults
+    unsigned streambuf_size; // 0 = STREAMBUF_SIZE
+    unsigned outputbuf_size; // 0 = OUTPUTBUF_SIZE
+    unsigned ring_bytes; // encoded audio queued per stream
+    unsigned http_chunk; // bytes per chunk sent to Sonos
+    unsigned lead_ms; // encoder throttle
+    unsigned block_frames; // codec block size, 0 = codec default
+    unsigned output_frames; // moved from squeezelite to the encoder at once, 0 = squeezelite default
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Latency and budget may be 0. With a budget (in KB) the latency is lowered to what fits; returns 0
+// when not even SBBUDGET_MIN_LATENCY_MS does. The rates of the codec size the HTTP chunks (typical)
+// and the queue of encoded audio (maximum).
+int sbbudget_profile(const char* name); // "default" or "lowlatency", before sbbudget_configure()
+int sbbudget_configure(unsigned latency_ms, unsigned budget_kb, unsigned typical_bytes_per_s, unsigned max_bytes_per_s);
+const struct sbbudget* sbbudget_get(void);
+size_t sbbudget_bytes(void); // planned total, excluding squeezelite defaults
+void sbbudget_release(void* buf, size_t size); // contents are lost, pages come back on next use
+void sbbudget_trim(void); // free idle rings and heap memory to the OS
+int64_t sbbudget_rss_bytes(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* SBBUDGET_H */
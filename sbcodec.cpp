@@ -0,0 +1,524 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "sbcodec.h"
+#include "private/byteorder.h"
+#include "sbencoder.h"
+#include "sbflac.h"
+#include "sbmetrics.h"
+#include "sbtrace.h"
+
+#include <FLAC++/encoder.h>
+#include <cstdlib>
+#include <cstring>
+#include <lame/lame.h>
+#include <vector>
+
+#define SAMPLES 1024 // per channel, converted and passed to the codec at once
+#define MP3_DEFAULT_KBPS 192
+#define PCM_BYTES_PER_S (44100 * 4)
+#define FLAC_SILENT_BLOCKS 8 // constant blocks still encoded by libFLAC, about 0.75 s at 4096 frames
+
+using namespace NSROOT;
+
+namespace {
+
+SBCodec::Config g_config;
+
+// convert packed little-endian samples of the given size to 32-bit integers, sign extended
+void unpack(const char* data, int samples, uint8_t sampleSize, FLAC__int32* out)
+{
+    for (int i = 0; i < samples; i++) {
+        switch (sampleSize) {
+        case 8:
+            out[i] = (unsigned char)(*data) - 128;
+            data += 1;
+            break;
+        case 16:
+            out[i] = read16le(data);
+            data += 2;
+            break;
+        case 24:
+            out[i] = read24le(data);
+            data += 3;
+            break;
+        case 32:
+            out[i] = read32le(data);
+            data += 4;
+            break;
+        default:
+            out[i] = 0;
+        }
+    }
+}
+
+// True when every frame of the block equals the first, as in digital silence. Branch-free, so the
+// compiler vectorises it: a block of music costs about as much as copying it.
+bool constantBlock(const FLAC__int32* pcm, unsigned frames)
+{
+    FLAC__int32 diff = 0;
+    for (unsigned i = 2; i < frames * 2; ++i) {
+        diff |= pcm[i] ^ pcm[i - 2];
+    }
+    return diff == 0;
+}
+
+// FLAC frames are written by libFLAC, except for blocks with the same sample in every frame: those
+// are written here as a frame of two constant subframes, without running the encoder. libFLAC only
+// encodes a block once the first sample of the next one arrived, so it has to be finished (flushing
+// the block it holds) before such a frame, and set up again for the next block of music. To keep
+// that to one setup per silence, the first FLAC_SILENT_BLOCKS constant blocks after music still go
+// to libFLAC: short gaps never leave it. Frame numbers, which libFLAC restarts with every setup, are
+// rewritten to run on across the stream. With "flac:fast" the blocks of music go to SBFlacEncoder
+// instead, which holds nothing back, so every constant block is written here.
+class FlacCodec : public SBCodec {
+public:
+    FlacCodec(SBEncoder* encoder, bool fast)
+        : SBCodec(encoder)
+        , m_stream(this)
+        , m_fast(fast)
+        , m_level(5)
+        , m_blockSize(0)
+        , m_block(nullptr)
+        , m_fill(0)
+        , m_active(false)
+        , m_header(true)
+        , m_number(0)
+        , m_silent(0)
+        , m_musicUs(0)
+        , m_musicBlocks(0)
+        , m_savedUs(0)
+    {
+    }
+    ~FlacCodec() override
+    {
+        finish();
+        delete[] m_block;
+    }
+
+    int open(uint8_t sampleSize, unsigned compressionLevel, unsigned blockSize) override
+    {
+        m_sampleSize = sampleSize;
+        m_level = compressionLevel;
+        m_blockSize = blockSize;
+        int r = setup(); // writes the stream header
+        m_header = false;
+        if (r == 0) {
+            m_blockSize = m_fast ? m_native.blockSize() : m_stream.get_blocksize();
+            m_block = new FLAC__int32[m_blockSize * 2];
+            m_frame.reserve(m_blockSize * 2 * 4 + 64); // a verbatim frame of 32-bit samples and its header
+        }
+        return r;
+    }
+
+    bool encode(const char* data, int frames) override
+    {
+        while (frames > 0) {
+            int need = m_blockSize - m_fill;
+            if (need > frames) {
+                need = frames;
+            }
+            // convert the packed little-endian PCM samples into an interleaved FLAC__int32 block
+            unpack(data, need * 2, m_sampleSize, m_block + m_fill * 2);
+            data += need * 2 * (m_sampleSize / 8);
+            m_fill += need;
+            frames -= need;
+            if (m_fill == m_blockSize) {
+                m_fill = 0;
+                if (!writeBlock()) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void finish() override
+    {
+        if (m_fill) {
+            process(m_fill);
+            m_fill = 0;
+        }
+        if (m_active) {
+            m_active = false;
+            m_stream.finish();
+        }
+    }
+
+    // The incomplete block is passed on as samples: encoded, its short frame would have to be the
+    // last of the stream.
+    std::string detach() override
+    {
+        if (m_active) {
+            m_active = false;
+            m_stream.finish();
+        }
+        uint32_t head[3] = { m_number, m_blockSize, m_fill };
+        std::string state((const char*)head, sizeof(head));
+        state.append((const char*)m_block, m_fill * 2 * sizeof(FLAC__int32));
+        m_fill = 0;
+        return state;
+    }
+
+    int resume(const std::string& state, uint8_t sampleSize, unsigned compressionLevel) override
+    {
+        uint32_t head[3]; // next frame number, block size, samples in the block
+        if (state.size() < sizeof(head)) {
+            return -1;
+        }
+        memcpy(head, state.data(), sizeof(head));
+        if (head[2] >= head[1] || state.size() != sizeof(head) + (size_t)head[2] * 2 * sizeof(FLAC__int32)) {
+            return -1;
+        }
+        m_header = false; // sent by the process that started the stream
+        int r = open(sampleSize, compressionLevel, head[1]);
+        if (r == 0 && m_blockSize != head[1]) {
+            r = -1; // frames of another size cannot follow in a stream of fixed block size
+        }
+        if (r == 0) {
+            m_number = head[0];
+            m_fill = head[2];
+            memcpy(m_block, state.data() + sizeof(head), m_fill * 2 * sizeof(FLAC__int32));
+        }
+        return r;
+    }
+
+private:
+    int setup()
+    {
+        if (m_fast) {
+            if (m_native.open(m_sampleSize, m_blockSize, m_level)) {
+                uint8_t header[SBFlacEncoder::STREAM_HEADER_BYTES];
+                size_t n = m_native.streamHeader(header);
+                return !m_header || output((const char*)header, (int)n) == (int)n ? 0 : -1;
+            }
+            m_fast = false; // 32-bit samples are left to libFLAC
+        }
+        m_stream.set_verify(true);
+        m_stream.set_compression_level(m_level);
+        if (m_blockSize) {
+            m_stream.set_blocksize(m_blockSize); // after the compression level, which also sets a block size
+        }
+        m_stream.set_channels(2);
+        m_stream.set_bits_per_sample(m_sampleSize);
+        m_stream.set_sample_rate(44100);
+        int r = m_stream.init();
+        m_active = (r == 0);
+        return r;
+    }
+
+    bool process(unsigned frames)
+    {
+        if (!m_fast && !m_active) { // after a silence
+            uint64_t begin = sbtrace_now_us();
+            int r = setup();
+            addSaved(-(int64_t)(sbtrace_now_us() - begin));
+            sbmetrics_add(SBM_FLAC_SETUPS, 1);
+            if (r != 0) {
+                return false;
+            }
+        }
+        uint64_t begin = sbtrace_now_us();
+        bool ok;
+        if (m_fast) {
+            size_t bytes;
+            const uint8_t* frame = m_native.encode(m_block, frames, m_number++, &bytes);
+            ok = output((const char*)frame, (int)bytes) == (int)bytes;
+        } else {
+            ok = m_stream.process_interleaved(m_block, frames);
+        }
+        if (!m_silent) {
+            m_musicUs += sbtrace_now_us() - begin;
+            ++m_musicBlocks;
+        }
+        return ok;
+    }
+
+    bool writeBlock()
+    {
+        if (!constantBlock(m_block, m_blockSize)) {
+            m_silent = 0;
+            return process(m_blockSize);
+        }
+        if (m_active && ++m_silent < FLAC_SILENT_BLOCKS) {
+            return process(m_blockSize);
+        }
+        if (m_active) {
+            m_active = false;
+            m_stream.finish(); // resets its settings, setup() applies them again
+        }
+        uint64_t begin = sbtrace_now_us();
+        bool ok = writeConstant();
+        if (m_musicBlocks) { // saved: what a block of music costs on average, less this frame
+            addSaved((int64_t)(m_musicUs / m_musicBlocks) - (int64_t)(sbtrace_now_us() - begin));
+        }
+        return ok;
+    }
+
+    // The saved time is exported once it outweighs the setups that silence cost.
+    void addSaved(int64_t us)
+    {
+        m_savedUs += us;
+        if (m_savedUs > 0) {
+            sbmetrics_add(SBM_CONSTANT_SAVED_US, m_savedUs);
+            m_savedUs = 0;
+        }
+    }
+
+    bool writeConstant()
+    {
+        uint8_t frame[32];
+        size_t n = SBFlacEncoder::frameHeader(frame, m_blockSize, 1, m_sampleSize, m_number++); // left, right
+        for (int channel = 0; channel < 2; ++channel) {
+            frame[n++] = 0x00; // constant subframe
+            for (int shift = m_sampleSize - 8; shift >= 0; shift -= 8) {
+                frame[n++] = (uint8_t)(m_block[channel] >> shift);
+            }
+        }
+        uint16_t crc = SBFlacEncoder::crc16(frame, n);
+        frame[n++] = (uint8_t)(crc >> 8);
+        frame[n++] = (uint8_t)crc;
+        sbmetrics_add(SBM_CONSTANT_FRAMES, 1);
+        return output((const char*)frame, (int)n) == (int)n;
+    }
+
+    // passes a frame from libFLAC on with the next frame number of the stream
+    bool writeFrame(const uint8_t* buffer, size_t bytes, unsigned current_frame)
+    {
+        uint32_t number = m_number++;
+        if (number == current_frame) {
+            return output((const char*)buffer, (int)bytes) == (int)bytes;
+        }
+        size_t size = 1; // coded frame number, its length is the number of leading ones
+        if (buffer[4] & 0x80) {
+            for (size = 0; buffer[4] & (0x80 >> size); ++size) { }
+        }
+        size_t extra = 0;
+        unsigned blockSizeCode = buffer[2] >> 4;
+        unsigned sampleRateCode = buffer[2] & 0x0f;
+        extra += blockSizeCode == 6 ? 1 : blockSizeCode == 7 ? 2 : 0;
+        extra += sampleRateCode == 12 ? 1 : (sampleRateCode == 13 || sampleRateCode == 14) ? 2 : 0;
+        size_t body = 4 + size + extra + 1; // past the header CRC-8
+        if (bytes < body + 2) {
+            return false;
+        }
+        m_frame.resize(bytes + 6);
+        uint8_t* frame = m_frame.data();
+        memcpy(frame, buffer, 4);
+        size_t n = 4 + SBFlacEncoder::putFrameNumber(frame + 4, number);
+        memcpy(frame + n, buffer + 4 + size, extra);
+        n += extra;
+        frame[n] = SBFlacEncoder::crc8(frame, n);
+        ++n;
+        memcpy(frame + n, buffer + body, bytes - body - 2);
+        n += bytes - body - 2;
+        uint16_t crc = SBFlacEncoder::crc16(frame, n);
+        frame[n++] = (uint8_t)(crc >> 8);
+        frame[n++] = (uint8_t)crc;
+        return output((const char*)frame, (int)n) == (int)n;
+    }
+
+    class Stream : public FLAC::Encoder::Stream {
+    public:
+        explicit Stream(FlacCodec* p)
+            : m_p(p)
+        {
+        }
+        FLAC__StreamEncoderWriteStatus write_callback(const FLAC__byte buffer[], size_t bytes, unsigned samples, unsigned current_frame) override
+        {
+            if (!samples && !m_p->m_header) {
+                return FLAC__STREAM_ENCODER_WRITE_STATUS_OK; // stream header of a new setup
+            }
+            uint64_t t = sbtrace_begin();
+            bool ok = samples ? m_p->writeFrame(buffer, bytes, current_frame)
+                              : m_p->output((const char*)buffer, (int)bytes) == (int)bytes;
+            sbtrace_end(SBS_FLAC_WRITE, m_p->m_encoder->streamId(), t, current_frame);
+            return (ok ? FLAC__STREAM_ENCODER_WRITE_STATUS_OK : FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR);
+        }
+
+    private:
+        FlacCodec* m_p;
+    };
+
+    Stream m_stream;
+    bool m_fast;
+    SBFlacEncoder m_native;
+    unsigned m_level;
+    unsigned m_blockSize;
+    FLAC__int32* m_block; // PCM collected until a block is complete
+    unsigned m_fill; // frames in m_block
+    bool m_active; // libFLAC is set up, and may hold samples
+    bool m_header; // metadata from libFLAC is the stream header
+    uint32_t m_number; // of the next frame
+    unsigned m_silent; // constant blocks in a row
+    uint64_t m_musicUs; // time spent on blocks of music
+    uint64_t m_musicBlocks;
+    int64_t m_savedUs; // not yet exported, negative while setups outweigh it
+    std::vector<uint8_t> m_frame; // renumbered frame
+};
+
+class Mp3Codec : public SBCodec {
+public:
+    Mp3Codec(SBEncoder* encoder, unsigned kbps)
+        : SBCodec(encoder)
+        , m_kbps(kbps)
+        , m_lame(nullptr)
+        , m_pcm(new FLAC__int32[SAMPLES * 2])
+        , m_pcm16(new short[SAMPLES * 2])
+        , m_mp3(new unsigned char[MP3_BUFFER])
+        , m_flushed(false)
+    {
+    }
+    ~Mp3Codec() override
+    {
+        finish();
+        if (m_lame) {
+            lame_close(m_lame);
+        }
+        delete[] m_pcm;
+        delete[] m_pcm16;
+        delete[] m_mp3;
+    }
+
+    int open(uint8_t sampleSize, unsigned compressionLevel, unsigned blockSize) override
+    {
+        (void)blockSize;
+        m_sampleSize = sampleSize;
+        m_lame = lame_init();
+        if (!m_lame) {
+            return -1;
+        }
+        lame_set_in_samplerate(m_lame, 44100);
+        lame_set_num_channels(m_lame, 2);
+        lame_set_brate(m_lame, m_kbps);
+        lame_set_mode(m_lame, JOINT_STEREO);
+        // FLAC levels go up with effort, LAME qualities down: level 5 is quality 4
+        lame_set_quality(m_lame, 9 - (compressionLevel > 9 ? 9 : compressionLevel));
+        lame_set_bWriteVbrTag(m_lame, 0); // a stream is never rewound to fill it in
+        int r = lame_init_params(m_lame);
+        return r < 0 ? r : 0;
+    }
+
+    bool encode(const char* data, int frames) override
+    {
+        while (frames > 0) {
+            int need = (frames > SAMPLES ? SAMPLES : frames);
+            unpack(data, need * 2, m_sampleSize, m_pcm);
+            data += need * 2 * (m_sampleSize / 8);
+            int shift = m_sampleSize > 16 ? m_sampleSize - 16 : 0;
+            int scale = m_sampleSize == 8 ? 8 : 0;
+            for (int i = 0; i < need * 2; ++i) {
+                m_pcm16[i] = (short)((m_pcm[i] >> shift) << scale);
+            }
+            int n = lame_encode_buffer_interleaved(m_lame, m_pcm16, need, m_mp3, MP3_BUFFER);
+            if (n < 0 || output((const char*)m_mp3, n) != n) {
+                return false;
+            }
+            frames -= need;
+        }
+        return true;
+    }
+
+    void finish() override
+    {
+        if (m_lame && !m_flushed) {
+            m_flushed = true;
+            int n = lame_encode_flush(m_lame, m_mp3, MP3_BUFFER);
+            if (n > 0) {
+                output((const char*)m_mp3, n);
+            }
+        }
+    }
+
+private:
+    static const int MP3_BUFFER = SAMPLES * 5 / 4 + 7200; // worst case given by LAME
+
+    unsigned m_kbps;
+    lame_t m_lame;
+    FLAC__int32* m_pcm;
+    short* m_pcm16;
+    unsigned char* m_mp3;
+    bool m_flushed;
+};
+
+} // namespace
+
+bool SBCodec::configure(const char* spec)
+{
+    const char* colon = strchr(spec, ':');
+    size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+    if (len == 4 && strncmp(spec, "flac", len) == 0 && (!colon || strcmp(colon + 1, "fast") == 0)) {
+        g_config.type = FLAC;
+        g_config.kbps = 0;
+        g_config.fast = colon != nullptr;
+        return true;
+    }
+    if (len == 3 && strncmp(spec, "mp3", len) == 0) {
+        unsigned kbps = colon ? (unsigned)atoi(colon + 1) : MP3_DEFAULT_KBPS;
+        if (kbps < 32 || kbps > 320) {
+            return false;
+        }
+        g_config.type = MP3;
+        g_config.kbps = kbps;
+        g_config.fast = false;
+        return true;
+    }
+    return false;
+}
+
+const SBCodec::Config& SBCodec::config()
+{
+    return g_config;
+}
+
+SBCodec* SBCodec::create(SBEncoder* encoder)
+{
+    switch (g_config.type) {
+    case MP3:
+        return new Mp3Codec(encoder, g_config.kbps);
+    case FLAC:
+    default:
+        return new FlacCodec(encoder, g_config.fast);
+    }
+}
+
+const char* SBCodec::name()
+{
+    return g_config.type == MP3 ? "mp3" : "flac";
+}
+
+const char* SBCodec::contentType()
+{
+    return g_config.type == MP3 ? "audio/mpeg" : "audio/flac";
+}
+
+unsigned SBCodec::typicalBytesPerSecond()
+{
+    return g_config.type == MP3 ? g_config.kbps * 1000 / 8 : 110000; // FLAC: about 60% of PCM
+}
+
+unsigned SBCodec::maxBytesPerSecond()
+{
+    return g_config.type == MP3 ? g_config.kbps * 1000 / 8 : PCM_BYTES_PER_S; // FLAC stays below PCM
+}
+
+int SBCodec::output(const char* data, int len)
+{
+    return m_encoder->writeEncodedData(data, len);
+}
@@ -0,0 +1,91 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SBCODEC_H
+#define SBCODEC_H
+
+#include "local_config.h"
+
+#include <cstdint>
+#include <string>
+
+namespace NSROOT {
+
+class SBEncoder;
+
+// Compression of the PCM written to an SBEncoder. The codec hands its output back to the encoder,
+// which queues it for the HTTP stream; throttling and buffering do not depend on the codec.
+class SBCodec {
+public:
+    typedef enum {
+        FLAC,
+        MP3,
+    } Type;
+
+    struct Config {
+        Type type = FLAC;
+        unsigned kbps = 0; // lossy codecs only
+        bool fast = false; // FLAC: SBFlacEncoder instead of libFLAC
+    };
+
+    static bool configure(const char* spec); // "flac[:fast]" or "mp3[:<kbit/s>]", for all streams
+    static const Config& config();
+    static SBCodec* create(SBEncoder* encoder);
+
+    static const char* name(); // of the configured codec, also the file extension in the URI
+    static const char* contentType();
+    static unsigned typicalBytesPerSecond(); // for sizing the HTTP chunks
+    static unsigned maxBytesPerSecond(); // for sizing the queue of encoded audio
+
+    virtual ~SBCodec() { }
+
+    // stereo at 44.1 kHz; returns 0 or a codec specific error
+    virtual int open(uint8_t sampleSize, unsigned compressionLevel, unsigned blockSize) = 0;
+    // packed little-endian samples, returns false on an encoder error
+    virtual bool encode(const char* data, int frames) = 0;
+    virtual void finish() = 0;
+
+    // Handing a stream over to another process (see sbhandover.h): detach() writes out what the
+    // codec can without ending the stream and returns what it needs to go on, resume() takes that
+    // instead of open() and continues the stream without a new header.
+    virtual std::string detach()
+    {
+        finish();
+        return std::string();
+    }
+    virtual int resume(const std::string& state, uint8_t sampleSize, unsigned compressionLevel)
+    {
+        (void)state;
+        return open(sampleSize, compressionLevel, 0);
+    }
+
+protected:
+    explicit SBCodec(SBEncoder* encoder)
+        : m_encoder(encoder)
+        , m_sampleSize(16)
+    {
+    }
+    int output(const char* data, int len);
+
+    SBEncoder* m_encoder;
+    uint8_t m_sampleSize;
+};
+}
+
+#endif /* SBCODEC_H */
@@ -18,13 +18,15 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "sbencoder.h"
-#include "framebuffer.h"
-#include "private/byteorder.h"
+#include "sbbudget.h"
+#include "sbcodec.h"
+#include "sbmetrics.h"
+#include "sbring.h"
+#include "sbsched.h"
+#include "sbtrace.h"
+#include <ctime>
 #include <unistd.h>
 
-#define SAMPLES 1024
-#define FRAME_BUFFER_SIZE 256
-
 extern "C" {
 uint32_t get_sb_time_ms(void);
 unsigned get_squeezebox_stream_id(void);
@@ -32,34 +34,51 @@ unsigned get_squeezebox_stream_id(void);
 
 using namespace NSROOT;
 
-SBEncoder::SBEncoder(int stream)
-    : m_status(INIT)
+namespace {
+class SqueezeliteContext : public SBContext {
+public:
+    uint32_t timeMs() override { return get_sb_time_ms(); }
+    unsigned streamId() override { return get_squeezebox_stream_id(); }
+};
+
+uint64_t threadCpuUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+}
+
+SBContext* SBContext::Squeezelite()
+{
+    static SqueezeliteContext context;
+    return &context;
+}
+
+SBEncoder::SBEncoder(int stream, SBContext* context /*= SBContext::Squeezelite()*/)
+    : m_context(context)
+    , m_status(INIT)
     , m_start_ms(0)
     , m_total(0)
     , m_bytesPerFrame(0)
     , m_sampleSize(0)
     , m_stream(stream)
-    , m_pcm(nullptr)
-    , m_buffer(nullptr)
-    , m_packet(nullptr)
-    , m_consumed(0)
-    , m_encoder(nullptr)
+    , m_ring(nullptr)
+    , m_encoded(0)
+    , m_underrun(false)
+    , m_codec(nullptr)
+    , m_leadMs(sbbudget_get()->lead_ms)
+    , m_interrupted(false)
+    , m_failed(false)
 {
-    m_buffer = new FrameBuffer(FRAME_BUFFER_SIZE);
-    m_encoder = new SBEncoderStream(this);
+    m_ring = SBRing::acquire(sbbudget_get()->ring_bytes);
+    m_codec = SBCodec::create(this);
 }
 
 SBEncoder::~SBEncoder()
 {
-    m_encoder->finish();
-    delete m_encoder;
-    if (m_pcm != nullptr) {
-        delete[] m_pcm;
-    }
-    if (m_packet) {
-        m_buffer->freePacket(m_packet);
-    }
-    delete m_buffer;
+    delete m_codec; // finishes the stream into the ring
+    SBRing::release(m_ring);
 }
 
 bool SBEncoder::open()
@@ -68,9 +87,14 @@ bool SBEncoder::open()
 }
 
 bool SBEncoder::open(uint8_t sampleSize)
+{
+    return open(sampleSize, 5, sbbudget_get()->block_frames);
+}
+
+bool SBEncoder::open(uint8_t sampleSize, unsigned compressionLevel, unsigned blockSize)
 {
     if (m_status != INIT) {
-        printf("SBEncoder::open(stream=%d) -- already opened\n", m_stream);
+        sbtrace(SBT_ENC_OPEN_TWICE, m_stream, 0, 0);
         return false;
     }
 
@@ -82,62 +106,111 @@ bool SBEncoder::open(uint8_t sampleSize)
     m_format.channelCount = 2;
     m_format.codec = "audio/pcm";
 
-    m_encoder->set_verify(true);
-    m_encoder->set_compression_level(5);
-    m_encoder->set_channels(m_format.channelCount);
-    m_encoder->set_bits_per_sample(m_format.sampleSize);
-    m_encoder->set_sample_rate(m_format.sampleRate);
-
     m_bytesPerFrame = m_format.bytesPerFrame();
     m_sampleSize = m_format.sampleSize;
 
-    m_buffer->clear();
-    if (m_packet)
-        m_buffer->freePacket(m_packet);
-    m_packet = nullptr;
+    m_ring->clear();
 
-    if (m_pcm != nullptr)
-        delete[] m_pcm;
-    m_pcm = new FLAC__int32[SAMPLES * m_format.channelCount];
-
-    FLAC__StreamEncoderInitStatus init_status = m_encoder->init();
-    if (init_status == FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+    int init_status = m_codec->open(m_format.sampleSize, compressionLevel, blockSize);
+    if (init_status == 0) {
         m_status = ENCODING;
         return true;
     }
-    printf("SBEncoder::open(stream=%d) -- FLAC encoder error %s\n", m_stream, FLAC__StreamEncoderInitStatusString[init_status]);
+    sbtrace(SBT_ENC_OPEN_FAILED, m_stream, init_status, 0);
     m_status = CLOSED;
     return false;
 }
 
 int SBEncoder::bytesAvailable() const
 {
-    if (m_packet)
-        return (m_packet->size - m_consumed);
-    return m_buffer->bytesAvailable();
+    return (int)m_ring->bytesAvailable();
+}
+
+int32_t SBEncoder::aheadMs() const
+{
+    if (m_status != ENCODING || !m_start_ms) {
+        return 0;
+    }
+    return (int32_t)(encodedMs() - (m_context->timeMs() - m_start_ms));
+}
+
+uint32_t SBEncoder::encodedMs() const
+{
+    return (uint32_t)((uint64_t)m_total / (uint64_t)m_bytesPerFrame * (uint64_t)1000 / (uint64_t)44100);
 }
 
 void SBEncoder::close()
 {
-    m_encoder->finish();
+    m_codec->finish();
     m_status = CLOSED;
 }
 
-int SBEncoder::readData(char* data, int maxlen)
+void SBEncoder::interrupt()
+{
+    m_interrupted = true;
+}
+
+bool SBEncoder::detach(SBEncoderState& state)
+{
+    if (m_status != ENCODING && m_status != CLOSING) {
+        return false;
+    }
+    uint32_t encoded_ms = (uint32_t)((uint64_t)m_total / (uint64_t)m_bytesPerFrame * (uint64_t)1000 / (uint64_t)44100);
+    uint32_t played_ms = m_start_ms ? m_context->timeMs() - m_start_ms : 0;
+    state.sampleSize = (uint8_t)m_sampleSize;
+    state.leadMs = encoded_ms > played_ms ? encoded_ms - played_ms : 0;
+    state.codec = m_codec->detach(); // frames the codec held are in the ring now
+    state.pending.clear();
+    size_t s;
+    const char* span;
+    while ((span = m_ring->readSpan(&s)) && s) {
+        state.pending.append(span, s);
+        m_ring->consume(s);
+    }
+    m_status = CLOSED;
+    return true;
+}
+
+bool SBEncoder::resume(const SBEncoderState& state)
 {
-    if (m_packet == nullptr) {
-        m_packet = m_buffer->read();
-        m_consumed = 0;
+    if (m_status != INIT) {
+        sbtrace(SBT_ENC_OPEN_TWICE, m_stream, 0, 0);
+        return false;
     }
-    if (m_packet) {
-        int s = m_packet->size - m_consumed;
-        int r = (maxlen < s ? maxlen : s);
-        memcpy(data, m_packet->data + m_consumed, r);
-        m_consumed += r;
-        if (m_consumed >= m_packet->size) {
-            m_buffer->freePacket(m_packet);
-            m_packet = nullptr;
+    m_bytesPerFrame = 2 * (state.sampleSize / 8);
+    m_sampleSize = state.sampleSize;
+    m_ring->clear();
+    if (m_ring->write(state.pending.data(), state.pending.size()) != state.pending.size()) {
+        sbtrace(SBT_ENC_OPEN_FAILED, m_stream, -1, 0);
+        m_status = CLOSED;
+        return false;
+    }
+    m_encoded = state.pending.size();
+    int init_status = m_codec->resume(state.codec, m_sampleSize, 5);
+    if (init_status != 0) {
+        sbtrace(SBT_ENC_OPEN_FAILED, m_stream, init_status, 0);
+        m_status = CLOSED;
+        return false;
+    }
+    // the queued audio counts as encoded, so the lead stays what it was in the other process
+    m_total = (uint32_t)((uint64_t)state.leadMs * 44100 / 1000 * m_bytesPerFrame);
+    m_status = ENCODING;
+    return true;
+}
+
+int SBEncoder::readData(char* data, int maxlen)
+{
+    uint64_t t = sbtrace_begin();
+    size_t s;
+    const char* span = m_ring->readSpan(&s);
+    if (s) {
+        int r = ((size_t)maxlen < s ? maxlen : (int)s);
+        memcpy(data, span, r);
+        m_ring->consume(r);
+        if (m_stream == m_context->streamId()) {
+            sbmetrics_set(SBM_FRAMEBUFFER_BYTES, bytesAvailable());
         }
+        sbtrace_end(SBS_DEQUEUE, m_stream, t, r);
         return r;
     }
     return 0;
@@ -145,112 +218,127 @@ int SBEncoder::readData(char* data, int maxlen)
 
 int SBEncoder::encode(const char* data, int len)
 {
-    bool ok = true;
+    uint64_t t = sbtrace_begin();
+    uint64_t begin_us = sbtrace_now_us();
+    uint64_t begin_cpu_us = threadCpuUs();
     int samples = len / m_bytesPerFrame;
-    while (ok && samples > 0) {
-        int need = (samples > SAMPLES ? SAMPLES : static_cast<int>(samples));
-        // convert the packed little-endian PCM samples into an interleaved FLAC__int32 buffer for libFLAC
-        for (int i = 0; i < (need * 2 /*m_format.channelCount*/); i++) {
-            switch (m_sampleSize) {
-            case 8:
-                m_pcm[i] = (unsigned char)(*data) - 128;
-                data += 1;
-                break;
-            case 16:
-                m_pcm[i] = read16le(data);
-                data += 2;
-                break;
-            case 24:
-                m_pcm[i] = read24le(data);
-                data += 3;
-                break;
-            case 32:
-                m_pcm[i] = read32le(data);
-                data += 4;
-                break;
-            default:
-                m_pcm[i] = 0;
-            }
-        }
-        // feed samples to encoder
-        ok = m_encoder->process_interleaved(m_pcm, need);
-        samples -= need;
+    sbmetrics_add(SBM_ENCODED_AUDIO_US, (int64_t)samples * 1000000 / 44100);
+    if (!m_failed && !m_codec->encode(data, samples)) {
+        sbtrace(SBT_ENC_CODEC_FAILED, m_stream, 0, 0);
+        m_failed = true; // the codec cannot go on, write() ends the stream
     }
+    sbmetrics_add(SBM_ENCODE_US, sbtrace_now_us() - begin_us);
+    sbmetrics_add(SBM_ENCODE_CPU_US, threadCpuUs() - begin_cpu_us);
+    sbtrace_end(SBS_ENCODE, m_stream, t, len);
     return len;
 }
 
 int SBEncoder::writeEncodedData(const char* data, int len)
 {
-    return m_buffer->write(data, len);
+    uint64_t t = sbtrace_begin();
+    int r = (int)m_ring->write(data, len);
+    if (r != len) {
+        // Sonos stopped pulling and the ring is full. The frame is left out as a whole, so the stream
+        // stays decodable, and the codec is told it was written, so it goes on.
+        sbmetrics_add(SBM_DROPPED_FRAMES, 1);
+        sbtrace(SBT_ENC_RING_FULL, m_stream, len, m_ring->bytesAvailable());
+        return len;
+    }
+    m_encoded += r;
+    sbmetrics_add(SBM_ENCODED_BYTES, r);
+    if (m_stream == m_context->streamId()) {
+        sbmetrics_set(SBM_STREAM_ENCODED_BYTES, m_encoded);
+        sbmetrics_set(SBM_FRAMEBUFFER_BYTES, m_ring->bytesAvailable());
+    }
+    if (t) {
+        sbtrace_end(SBS_QUEUE, m_stream, t, r);
+        sbtrace_count(SBC_FRAMEBUFFER, m_stream, m_ring->bytesAvailable());
+    }
+    return r;
 }
 
-FLAC__StreamEncoderWriteStatus SBEncoder::SBEncoderStream::write_callback(const FLAC__byte buffer[], size_t bytes, unsigned samples, unsigned current_frame)
+int SBEncoder::read(char* data, int maxlen, unsigned timeout)
 {
-    int r = m_p->writeEncodedData((const char*)buffer, (int)bytes);
-    return (r == (int)bytes ? FLAC__STREAM_ENCODER_WRITE_STATUS_OK : FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR);
+    uint64_t t = sbtrace_begin();
+    int r = readWait(data, maxlen, timeout);
+    sbtrace_end(SBS_ENCODER_READ, m_stream, t, r);
+    return r;
 }
 
-int SBEncoder::read(char* data, int maxlen, unsigned timeout)
+int SBEncoder::readWait(char* data, int maxlen, unsigned timeout)
 {
     for (;;) {
-        if (m_status == CLOSED) {
-            printf("SBEncoder::read: encoder is closed\n");
+        if (m_status == CLOSED || m_interrupted) {
+            sbtrace(SBT_ENC_READ_CLOSED, m_stream, 0, 0);
             return 0;
         }
-        if (m_stream != get_squeezebox_stream_id()) {
-            printf("SBEncoder::read: stream mismatch (%d != %d)\n", m_stream, get_squeezebox_stream_id());
+        if (m_stream != m_context->streamId()) {
+            sbtrace(SBT_ENC_READ_MISMATCH, m_stream, m_stream, m_context->streamId());
             usleep(1000); // 1 ms
             return 0;
         }
         if (bytesAvailable()) {
             if (!m_start_ms) {
-                m_start_ms = get_sb_time_ms();
+                m_start_ms = m_context->timeMs();
             }
+            m_underrun = false;
             return readData(data, maxlen);
         } else if (m_status == CLOSING) {
-            printf("All data consumed\n");
+            sbtrace(SBT_ENC_READ_DRAINED, m_stream, 0, 0);
             close();
             return 0;
+        } else if (m_start_ms && !m_underrun) {
+            m_underrun = true;
+            sbmetrics_add(SBM_UNDERRUNS, 1);
         }
-        if (timeout) {
-            if (!timeout--) {
-                printf("SBEncoder::read: timeout\n");
-                return 0;
-            }
+        if (timeout && !--timeout) { // 0 = wait forever
+            sbtrace(SBT_ENC_READ_TIMEOUT, m_stream, 0, 0);
+            sbmetrics_add(SBM_STALLS, 1);
+            return 0;
         }
-        usleep(1000); // 1 ms
+        sbsched_sleep_us(SBR_HTTP, 1000); // 1 ms
     }
 }
 
 int SBEncoder::write(const char* data, int len, unsigned timeout)
 {
+    uint64_t throttled = 0;
     for (;;) {
         if (m_status != ENCODING) {
-            printf("SBEncoder::write: encoder not active\n");
+            sbtrace(SBT_ENC_WRITE_INACTIVE, m_stream, 0, 0);
             return 0;
         }
-        if (m_stream != get_squeezebox_stream_id()) {
-            printf("SBEncoder::write: stream mismatch (%d != %d)\n", m_stream, get_squeezebox_stream_id());
+        if (m_stream != m_context->streamId()) {
+            sbtrace(SBT_ENC_WRITE_MISMATCH, m_stream, m_stream, m_context->streamId());
             usleep(1000); // 1 ms
             return 0;
         }
-        if (len == 0) {
-            printf("Reached end of stream\n");
+        if (len == 0 || m_failed) {
+            sbtrace(SBT_ENC_WRITE_EOS, m_stream, 0, 0);
             m_status = CLOSING;
             return 0;
         }
-        uint32_t encoded_ms = (uint32_t)((uint64_t)m_total / (uint64_t)m_bytesPerFrame * (uint64_t)1000 / (uint64_t)44100);
-        uint32_t played_ms = m_start_ms ? get_sb_time_ms() - m_start_ms : 0;
-        if (encoded_ms < (played_ms + 2000)) {
+        uint32_t encoded_ms = encodedMs();
+        uint32_t played_ms = m_start_ms ? m_context->timeMs() - m_start_ms : 0;
+        if (m_start_ms) {
+            sbmetrics_set(SBM_LEAD_MS, (int64_t)encoded_ms - (int64_t)played_ms);
+        }
+        if (encoded_ms < (played_ms + m_leadMs)) {
+            sbtrace_end(SBS_THROTTLE, m_stream, throttled, 0);
+            if (!m_total) {
+                sbmetrics_skip_audio(m_stream);
+            }
             m_total += len;
             return encode(data, len);
         }
-        if (timeout) {
-            if (!timeout--) {
-                printf("SBEncoder::write: timeout\n");
-                return 0;
-            }
+        if (!throttled) {
+            throttled = sbtrace_begin();
+        }
+        if (timeout && !--timeout) { // 0 = wait forever
+            sbtrace(SBT_ENC_WRITE_TIMEOUT, m_stream, 0, 0);
+            sbmetrics_add(SBM_STALLS, 1);
+            return 0;
         }
-        usleep(1000); // 1 ms
+        sbsched_sleep_us(SBR_OUTPUT, 1000); // 1 ms, the encoder runs on the squeezelite output thread
     }
 }
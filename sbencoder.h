@@ -23,34 +23,66 @@
 #include "audioencoder.h"
 #include "local_config.h"
 
-#include <FLAC++/encoder.h>
-#include <FLAC++/metadata.h>
+#include <atomic>
+#include <string>
 
 namespace NSROOT {
 
-class FrameBuffer;
-class FramePacket;
+class SBCodec;
+class SBRing;
+
+// Clock and current stream id as seen by the encoder. The default implementation uses the
+// squeezelite output module; the benchmark provides a virtual clock.
+class SBContext {
+public:
+    virtual ~SBContext() { }
+    virtual uint32_t timeMs() = 0;
+    virtual unsigned streamId() = 0;
+
+    static SBContext* Squeezelite();
+};
+
+// What another process needs to go on with the stream of an encoder, see SBEncoder::detach()
+struct SBEncoderState {
+    uint8_t sampleSize = 16;
+    uint32_t leadMs = 0; // encoded ahead of playback
+    std::string codec; // from SBCodec::detach()
+    std::string pending; // encoded, not read by the HTTP stream yet
+};
 
 class SBEncoder {
-    friend class SBEncoderStream;
+    friend class SBCodec;
 
 public:
     SBEncoder();
-    SBEncoder(int buffered);
+    SBEncoder(int stream, SBContext* context = SBContext::Squeezelite());
     ~SBEncoder();
 
     bool open();
     bool open(uint8_t sampleSize);
+    bool open(uint8_t sampleSize, unsigned compressionLevel, unsigned blockSize);
+    // The timeout is in ms, spent waiting for the throttle (write) or for encoded data (read);
+    // 0 waits forever. On timeout both return 0 and count a stall.
     int write(const char* data, int len, unsigned timeout);
     int read(char* data, int maxlen, unsigned timeout);
     void close();
+    int bytesAvailable() const;
+    int32_t aheadMs() const; // encoded ahead of playback; 0 before Sonos reads and once closing
+
+    // Hand-over to another process: interrupt() makes read() return 0 from now on; once the reader
+    // stopped, detach() closes the encoder and takes out its state and the encoded data. The
+    // encoder of the other process continues the stream with resume(), instead of open().
+    void interrupt();
+    bool detach(SBEncoderState& state);
+    bool resume(const SBEncoderState& state);
 
     int streamId() { return m_stream; }
 
 private:
     int encode(const char* data, int len);
-    int bytesAvailable() const;
     int writeEncodedData(const char* data, int len);
+    uint32_t encodedMs() const;
+    int readWait(char* data, int maxlen, unsigned timeout);
     int readData(char* data, int maxlen);
 
 private:
@@ -61,31 +93,22 @@ private:
         CLOSED
     } Status_t;
 
+    SBContext* m_context;
     Status_t m_status;
     uint32_t m_start_ms; // time read of encoded data started
     uint32_t m_total; // pcm bytes encoded so far
     int m_bytesPerFrame;
     int m_sampleSize;
     unsigned m_stream;
-    FLAC__int32* m_pcm;
-
-    FrameBuffer* m_buffer;
-    FramePacket* m_packet;
-    int m_consumed;
-
-    class SBEncoderStream : public FLAC::Encoder::Stream {
-    public:
-        explicit SBEncoderStream(SBEncoder* p)
-            : m_p(p)
-        {
-        }
-        virtual FLAC__StreamEncoderWriteStatus write_callback(const FLAC__byte buffer[], size_t bytes, unsigned samples, unsigned current_frame);
 
-    private:
-        SBEncoder* m_p;
-    };
+    SBRing* m_ring; // encoded data, written by libFLAC and read by the HTTP stream
+    uint64_t m_encoded; // encoded bytes of this stream
+    bool m_underrun;
 
-    SBEncoderStream* m_encoder;
+    SBCodec* m_codec; // the one configured with SBCodec::configure()
+    uint32_t m_leadMs; // encoded ahead of playback at most
+    std::atomic<bool> m_interrupted;
+    bool m_failed; // set by encode(), write() ends the stream
 };
 
 }
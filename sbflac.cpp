@@ -0,0 +1,478 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "sbflac.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#define SBFLAC_DEFAULT_BLOCK 4096
+#define SBFLAC_MAX_PARTITION_ORDER 6
+#define SBFLAC_MAX_RICE 14 // 4-bit parameters, 15 is the escape code
+#define SBFLAC_MAX_RICE2 30 // 5-bit parameters
+
+using namespace NSROOT;
+
+namespace {
+
+uint8_t sampleSizeCode(uint8_t sampleSize)
+{
+    switch (sampleSize) {
+    case 8:
+        return 1;
+    case 12:
+        return 2;
+    case 16:
+        return 4;
+    case 20:
+        return 5;
+    case 24:
+        return 6;
+    case 32:
+        return 7;
+    default:
+        return 0; // as in the stream header
+    }
+}
+
+unsigned blockSizeCode(unsigned frames)
+{
+    for (unsigned c = 8; c < 16; ++c) {
+        if (frames == 256u << (c - 8)) {
+            return c;
+        }
+    }
+    for (unsigned c = 2; c < 6; ++c) {
+        if (frames == 576u << (c - 2)) {
+            return c;
+        }
+    }
+    return frames <= 256 ? 6 : 7; // 8 or 16 bits at the end of the header
+}
+
+inline uint32_t fold(int32_t e)
+{
+    return ((uint32_t)e << 1) ^ (uint32_t)(e >> 31);
+}
+
+// Rice parameter for count folded residuals adding up to sum, and the bits they take with it. The
+// bits are an upper bound: sum >> k is at least the sum of the shifted residuals.
+unsigned riceParameter(uint64_t sum, unsigned count, unsigned max, uint64_t* bits)
+{
+    unsigned k = 0;
+    while (k < max && ((uint64_t)count << (k + 1)) < sum) {
+        ++k;
+    }
+    uint64_t best = (uint64_t)count * (k + 1) + (sum >> k);
+    if (k > 0) {
+        uint64_t lower = (uint64_t)count * k + (sum >> (k - 1));
+        if (lower < best) {
+            best = lower;
+            --k;
+        }
+    }
+    *bits = best;
+    return k;
+}
+
+// CRC-8 (polynomial 0x07) of the frame header and CRC-16 (0x8005) of the frame
+struct CrcTables {
+    uint8_t crc8[256];
+    uint16_t crc16[256];
+
+    CrcTables()
+    {
+        for (unsigned i = 0; i < 256; ++i) {
+            uint8_t c8 = i;
+            uint16_t c16 = i << 8;
+            for (int b = 0; b < 8; ++b) {
+                c8 = (c8 & 0x80) ? (uint8_t)((c8 << 1) ^ 0x07) : (uint8_t)(c8 << 1);
+                c16 = (c16 & 0x8000) ? (uint16_t)((c16 << 1) ^ 0x8005) : (uint16_t)(c16 << 1);
+            }
+            crc8[i] = c8;
+            crc16[i] = c16;
+        }
+    }
+};
+
+// built once by whichever encoder thread gets here first, the others wait for it
+const CrcTables& crcTables()
+{
+    static const CrcTables tables;
+    return tables;
+}
+}
+
+SBFlacEncoder::SBFlacEncoder()
+    : m_sampleSize(16)
+    , m_blockSize(SBFLAC_DEFAULT_BLOCK)
+    , m_stereo(true)
+    , m_maxPartitionOrder(SBFLAC_MAX_PARTITION_ORDER)
+    , m_analysis()
+    , m_out(nullptr)
+    , m_acc(0)
+    , m_bits(0)
+{
+}
+
+bool SBFlacEncoder::open(uint8_t sampleSize, unsigned blockSize, unsigned level)
+{
+    if (sampleSize != 8 && sampleSize != 16 && sampleSize != 24) {
+        return false; // 32 bits would take a 33-bit side channel
+    }
+    if (!blockSize) {
+        blockSize = SBFLAC_DEFAULT_BLOCK;
+    }
+    if (blockSize < 16 || blockSize > 65535) {
+        return false;
+    }
+    m_sampleSize = sampleSize;
+    m_blockSize = blockSize;
+    m_stereo = level >= 1;
+    m_maxPartitionOrder = level >= 2 ? SBFLAC_MAX_PARTITION_ORDER : 3;
+    for (std::vector<int32_t>& channel : m_channel) {
+        channel.resize(blockSize);
+    }
+    m_residual.resize(blockSize);
+    m_sums.resize(1u << SBFLAC_MAX_PARTITION_ORDER);
+    m_frame.resize((size_t)blockSize * 2 * 4 + 64); // two verbatim subframes of the side channel fit
+    return true;
+}
+
+size_t SBFlacEncoder::streamHeader(uint8_t* out) const
+{
+    uint8_t* p = out;
+    memcpy(p, "fLaC", 4);
+    p += 4;
+    *p++ = 0x80; // last metadata block, STREAMINFO
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 34;
+    for (int i = 0; i < 2; ++i) { // minimum and maximum block size
+        *p++ = (uint8_t)(m_blockSize >> 8);
+        *p++ = (uint8_t)m_blockSize;
+    }
+    memset(p, 0, 6); // minimum and maximum frame size: unknown
+    p += 6;
+    // 20 bits sample rate, 3 bits channels - 1, 5 bits bits per sample - 1, 36 bits total samples
+    uint32_t rate = 44100;
+    unsigned bps = m_sampleSize - 1;
+    *p++ = (uint8_t)(rate >> 12);
+    *p++ = (uint8_t)(rate >> 4);
+    *p++ = (uint8_t)((rate & 0x0f) << 4 | 1 << 1 | bps >> 4);
+    *p++ = (uint8_t)((bps & 0x0f) << 4);
+    memset(p, 0, 4 + 16); // total samples unknown, no MD5 signature
+    p += 4 + 16;
+    return p - out;
+}
+
+const uint8_t* SBFlacEncoder::encode(const int32_t* pcm, unsigned frames, uint32_t number, size_t* bytes)
+{
+    int32_t* left = m_channel[0].data();
+    int32_t* right = m_channel[1].data();
+    int32_t* mid = m_channel[2].data();
+    int32_t* side = m_channel[3].data();
+    for (unsigned i = 0; i < frames; ++i) {
+        int32_t l = pcm[2 * i];
+        int32_t r = pcm[2 * i + 1];
+        left[i] = l;
+        right[i] = r;
+        mid[i] = (l + r) >> 1; // the decoder restores the lost bit from the side channel
+        side[i] = l - r;
+    }
+
+    unsigned bps = m_sampleSize;
+    unsigned channels = 1; // left, right
+    int first = 0;
+    int second = 1;
+    analyse(0, frames, bps);
+    analyse(1, frames, bps);
+    if (m_stereo) {
+        analyse(2, frames, bps);
+        analyse(3, frames, bps + 1);
+        uint64_t best = m_analysis[0].bits + m_analysis[1].bits;
+        if (m_analysis[0].bits + m_analysis[3].bits < best) {
+            best = m_analysis[0].bits + m_analysis[3].bits;
+            channels = 8; // left, side
+            first = 0;
+            second = 3;
+        }
+        if (m_analysis[3].bits + m_analysis[1].bits < best) {
+            best = m_analysis[3].bits + m_analysis[1].bits;
+            channels = 9; // side, right
+            first = 3;
+            second = 1;
+        }
+        if (m_analysis[2].bits + m_analysis[3].bits < best) {
+            channels = 10; // mid, side
+            first = 2;
+            second = 3;
+        }
+    }
+
+    m_out = m_frame.data();
+    m_acc = 0;
+    m_bits = 0;
+    m_out += frameHeader(m_out, frames, channels, m_sampleSize, number);
+    writeSubframe(first, frames, first == 3 ? bps + 1 : bps);
+    writeSubframe(second, frames, second == 3 ? bps + 1 : bps);
+    if (m_bits) {
+        put(0, 8 - m_bits);
+    }
+    size_t n = m_out - m_frame.data();
+    uint16_t crc = crc16(m_frame.data(), n);
+    m_frame[n++] = (uint8_t)(crc >> 8);
+    m_frame[n++] = (uint8_t)crc;
+    *bytes = n;
+    return m_frame.data();
+}
+
+// Picks the fixed predictor with the smallest sum of absolute residuals, computed for all orders
+// in one pass, and estimates the size of the subframe from it.
+void SBFlacEncoder::analyse(int channel, unsigned frames, unsigned bps)
+{
+    const int32_t* x = m_channel[channel].data();
+    Analysis& a = m_analysis[channel];
+    int32_t diff = 0;
+    for (unsigned i = 1; i < frames; ++i) {
+        diff |= x[i] ^ x[0];
+    }
+    a.constant = diff == 0;
+    a.order = 0;
+    if (a.constant) {
+        a.bits = 8 + bps;
+        return;
+    }
+    uint64_t sum[5] = { 0, 0, 0, 0, 0 };
+    for (unsigned i = 4; i < frames; ++i) {
+        int32_t e0 = x[i];
+        int32_t e1 = e0 - x[i - 1];
+        int32_t e2 = e1 - (x[i - 1] - x[i - 2]);
+        int32_t e3 = e2 - (x[i - 1] - 2 * x[i - 2] + x[i - 3]);
+        int32_t e4 = e3 - (x[i - 1] - 3 * x[i - 2] + 3 * x[i - 3] - x[i - 4]);
+        sum[0] += (uint32_t)abs(e0);
+        sum[1] += (uint32_t)abs(e1);
+        sum[2] += (uint32_t)abs(e2);
+        sum[3] += (uint32_t)abs(e3);
+        sum[4] += (uint32_t)abs(e4);
+    }
+    unsigned order = 0;
+    for (unsigned o = 1; o < 5 && o < frames; ++o) {
+        if (sum[o] < sum[order]) {
+            order = o;
+        }
+    }
+    uint64_t bits;
+    unsigned count = frames > 4 ? frames - 4 : 1;
+    riceParameter(sum[order] * 2, count, SBFLAC_MAX_RICE2, &bits); // folding doubles the residuals
+    a.order = order;
+    a.bits = 8 + order * bps + 6 + 4 + bits;
+    if (a.bits > 8 + (uint64_t)frames * bps) {
+        a.bits = 8 + (uint64_t)frames * bps; // verbatim
+    }
+}
+
+void SBFlacEncoder::writeSubframe(int channel, unsigned frames, unsigned bps)
+{
+    const int32_t* x = m_channel[channel].data();
+    const Analysis& a = m_analysis[channel];
+    if (a.constant) {
+        put(0x00, 8);
+        put((uint32_t)x[0], bps);
+        return;
+    }
+
+    unsigned order = a.order;
+    uint32_t* u = m_residual.data();
+    switch (order) {
+    case 0:
+        for (unsigned i = 0; i < frames; ++i) {
+            u[i] = fold(x[i]);
+        }
+        break;
+    case 1:
+        for (unsigned i = 1; i < frames; ++i) {
+            u[i] = fold(x[i] - x[i - 1]);
+        }
+        break;
+    case 2:
+        for (unsigned i = 2; i < frames; ++i) {
+            u[i] = fold(x[i] - 2 * x[i - 1] + x[i - 2]);
+        }
+        break;
+    case 3:
+        for (unsigned i = 3; i < frames; ++i) {
+            u[i] = fold(x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3]);
+        }
+        break;
+    default:
+        for (unsigned i = 4; i < frames; ++i) {
+            u[i] = fold(x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4]);
+        }
+        break;
+    }
+
+    // partition sums at the highest order that divides the block, merged pairwise for each lower one
+    unsigned maxOrder = m_maxPartitionOrder;
+    while (maxOrder && ((frames & ((1u << maxOrder) - 1)) || (frames >> maxOrder) <= order)) {
+        --maxOrder;
+    }
+    uint64_t* sums = m_sums.data();
+    unsigned size = frames >> maxOrder;
+    for (unsigned p = 0; p < (1u << maxOrder); ++p) {
+        uint64_t s = 0;
+        for (unsigned i = (p ? p * size : order); i < (p + 1) * size; ++i) {
+            s += u[i];
+        }
+        sums[p] = s;
+    }
+    uint64_t best = UINT64_MAX;
+    unsigned bestOrder = 0;
+    for (int po = maxOrder; po >= 0; --po) {
+        unsigned parts = 1u << po;
+        size = frames >> po;
+        uint64_t bits = 2 + 4;
+        bool rice2 = false;
+        for (unsigned p = 0; p < parts; ++p) {
+            uint64_t partBits;
+            unsigned k = riceParameter(sums[p], size - (p ? 0 : order), SBFLAC_MAX_RICE2, &partBits);
+            rice2 |= k > SBFLAC_MAX_RICE;
+            bits += 4 + partBits;
+        }
+        if (rice2) {
+            bits += parts;
+        }
+        if (bits <= best) {
+            best = bits;
+            bestOrder = po;
+        }
+        for (unsigned p = 0; p < parts / 2; ++p) {
+            sums[p] = sums[2 * p] + sums[2 * p + 1];
+        }
+    }
+
+    if ((uint64_t)order * bps + best >= (uint64_t)frames * bps) {
+        put(0x02, 8); // verbatim
+        for (unsigned i = 0; i < frames; ++i) {
+            put((uint32_t)x[i], bps);
+        }
+        return;
+    }
+    put(0x10 | order << 1, 8); // fixed
+    for (unsigned i = 0; i < order; ++i) {
+        put((uint32_t)x[i], bps);
+    }
+    writeResidual(frames, order, bestOrder);
+}
+
+void SBFlacEncoder::writeResidual(unsigned frames, unsigned order, unsigned partitionOrder)
+{
+    const uint32_t* u = m_residual.data();
+    unsigned parts = 1u << partitionOrder;
+    unsigned size = frames >> partitionOrder;
+    uint8_t params[1u << SBFLAC_MAX_PARTITION_ORDER];
+    bool rice2 = false;
+    for (unsigned p = 0; p < parts; ++p) {
+        uint64_t s = 0;
+        for (unsigned i = (p ? p * size : order); i < (p + 1) * size; ++i) {
+            s += u[i];
+        }
+        uint64_t bits;
+        params[p] = (uint8_t)riceParameter(s, size - (p ? 0 : order), SBFLAC_MAX_RICE2, &bits);
+        rice2 |= params[p] > SBFLAC_MAX_RICE;
+    }
+    put(rice2 ? 1 : 0, 2);
+    put(partitionOrder, 4);
+    for (unsigned p = 0; p < parts; ++p) {
+        unsigned k = params[p];
+        put(k, rice2 ? 5 : 4);
+        uint32_t mask = (1u << k) - 1;
+        for (unsigned i = (p ? p * size : order); i < (p + 1) * size; ++i) {
+            uint32_t q = u[i] >> k;
+            if (q + 1 + k <= 32) {
+                put((1u << k) | (u[i] & mask), q + 1 + k); // q zeros, a one, the low k bits
+            } else {
+                for (; q >= 32; q -= 32) {
+                    put(0, 32);
+                }
+                put(1, q + 1);
+                put(u[i] & mask, k);
+            }
+        }
+    }
+}
+
+size_t SBFlacEncoder::frameHeader(uint8_t* out, unsigned frames, unsigned channels, uint8_t sampleSize, uint32_t number)
+{
+    size_t n = 0;
+    unsigned code = blockSizeCode(frames);
+    out[n++] = 0xff;
+    out[n++] = 0xf8; // fixed block size
+    out[n++] = (uint8_t)(code << 4 | 9); // 44.1 kHz
+    out[n++] = (uint8_t)(channels << 4 | sampleSizeCode(sampleSize) << 1);
+    n += putFrameNumber(out + n, number);
+    if (code == 6) {
+        out[n++] = (uint8_t)(frames - 1);
+    } else if (code == 7) {
+        out[n++] = (uint8_t)((frames - 1) >> 8);
+        out[n++] = (uint8_t)(frames - 1);
+    }
+    out[n] = crc8(out, n);
+    return n + 1;
+}
+
+uint8_t SBFlacEncoder::crc8(const uint8_t* data, size_t len)
+{
+    const uint8_t* table = crcTables().crc8;
+    uint8_t crc = 0;
+    while (len--) {
+        crc = table[crc ^ *data++];
+    }
+    return crc;
+}
+
+uint16_t SBFlacEncoder::crc16(const uint8_t* data, size_t len)
+{
+    const uint16_t* table = crcTables().crc16;
+    uint16_t crc = 0;
+    while (len--) {
+        crc = (uint16_t)((crc << 8) ^ table[(crc >> 8) ^ *data++]);
+    }
+    return crc;
+}
+
+// as coded in a FLAC frame header
+size_t SBFlacEncoder::putFrameNumber(uint8_t* out, uint32_t number)
+{
+    if (number < 0x80) {
+        out[0] = (uint8_t)number;
+        return 1;
+    }
+    size_t n = 2;
+    while (n < 6 && number >= (1u << (5 * n + 1))) {
+        ++n;
+    }
+    for (size_t i = n - 1; i > 0; --i) {
+        out[i] = (uint8_t)(0x80 | (number & 0x3f));
+        number >>= 6;
+    }
+    out[0] = (uint8_t)((0xff00 >> n) | number);
+    return n;
+}
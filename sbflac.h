@@ -0,0 +1,98 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SBFLAC_H
+#define SBFLAC_H
+
+#include "local_config.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace NSROOT {
+
+// In-tree FLAC encoder for what is sent to Sonos: stereo at 44.1 kHz, 8 to 24 bits per sample.
+// Every channel is coded with the best fixed predictor (order 0 to 4), the stereo coding (left and
+// right, left and side, right and side, or mid and side) is picked per frame from the estimated
+// residual sizes, and the residual is Rice coded with the partition order and parameters that need
+// the fewest bits. That is what libFLAC does at its lowest levels, without the LPC analysis, the
+// verification and the callbacks of its general-purpose encoder. The hot loops are kept free of
+// branches and dependencies between samples, so the compiler vectorises them.
+class SBFlacEncoder {
+public:
+    SBFlacEncoder();
+
+    // level 0 codes left and right only, level 1 picks the stereo coding, level 2 and up also
+    // search finer Rice partitions; blockSize 0 is 4096
+    bool open(uint8_t sampleSize, unsigned blockSize, unsigned level);
+    unsigned blockSize() const { return m_blockSize; }
+
+    // "fLaC" and the STREAMINFO block
+    size_t streamHeader(uint8_t* out) const;
+    static const size_t STREAM_HEADER_BYTES = 42;
+
+    // one frame of up to blockSize() interleaved stereo frames, valid until the next call
+    const uint8_t* encode(const int32_t* pcm, unsigned frames, uint32_t number, size_t* bytes);
+
+    // frame header up to and including its CRC-8; channels is the channel assignment code
+    static size_t frameHeader(uint8_t* out, unsigned frames, unsigned channels, uint8_t sampleSize, uint32_t number);
+    static size_t putFrameNumber(uint8_t* out, uint32_t number); // 1 to 6 bytes
+    static uint8_t crc8(const uint8_t* data, size_t len);
+    static uint16_t crc16(const uint8_t* data, size_t len);
+
+private:
+    struct Analysis {
+        bool constant;
+        unsigned order;
+        uint64_t bits; // estimated size of the subframe
+    };
+
+    void analyse(int channel, unsigned frames, unsigned bps);
+    void writeSubframe(int channel, unsigned frames, unsigned bps);
+    void writeResidual(unsigned frames, unsigned order, unsigned partitionOrder);
+
+    void put(uint32_t value, unsigned bits)
+    {
+        m_acc = (m_acc << bits) | (value & (uint32_t)((1ull << bits) - 1));
+        m_bits += bits;
+        while (m_bits >= 8) {
+            m_bits -= 8;
+            *m_out++ = (uint8_t)(m_acc >> m_bits);
+        }
+    }
+
+    uint8_t m_sampleSize;
+    unsigned m_blockSize;
+    bool m_stereo; // pick the stereo coding
+    unsigned m_maxPartitionOrder;
+
+    std::vector<int32_t> m_channel[4]; // left, right, mid, side
+    Analysis m_analysis[4];
+    std::vector<uint32_t> m_residual; // folded to unsigned: 0, -1, 1, -2, ... as 0, 1, 2, 3, ...
+    std::vector<uint64_t> m_sums; // of the residual per partition
+    std::vector<uint8_t> m_frame;
+    uint8_t* m_out;
+    uint64_t m_acc;
+    unsigned m_bits;
+};
+}
+
+#endif /* SBFLAC_H */
@@ -0,0 +1,342 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "sbhandover.h"
+#include "sbcodec.h"
+#include "sbencoder.h"
+#include "sbmetrics.h"
+#include "sbstreamer.h"
+#include "sbtrace.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+#define SBHANDOVER_MAGIC 0x53424844 // "SBHD"
+#define SBHANDOVER_VERSION 1
+#define SBHANDOVER_TIMEOUT_S 10
+
+extern "C" {
+unsigned get_squeezebox_stream_id(void);
+void adopt_squeezebox_stream(unsigned id, bool playing);
+} // extern "C"
+
+using namespace NSROOT;
+
+namespace {
+
+// Sent first, with the connection to Sonos attached when there is a stream; the codec state and
+// the pending audio follow.
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t stream;
+    uint32_t codec; // SBCodec::Type, the new process must be configured the same
+    uint32_t kbps;
+    uint32_t sampleSize;
+    uint32_t leadMs;
+    uint32_t codecBytes;
+    uint32_t pendingBytes;
+    uint64_t parkedUs; // when the old process stopped sending, sbtrace_now_us()
+};
+
+bool address(const std::string& path, struct sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.length() >= sizeof(addr.sun_path)) {
+        printf("Handover socket path too long: %s\n", path.c_str());
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.length());
+    return true;
+}
+
+bool writeAll(int s, const char* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t r = ::send(s, data, len, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return false;
+        }
+        data += r;
+        len -= r;
+    }
+    return true;
+}
+
+bool readAll(int s, std::string& data, size_t len)
+{
+    data.resize(len);
+    size_t n = 0;
+    while (n < len) {
+        ssize_t r = ::recv(s, &data[n], len - n, 0);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return false;
+        }
+        n += r;
+    }
+    return true;
+}
+
+// The connection of the stream is accepted by noson and not exposed. It is the established TCP
+// connection on the HTTP port that sent the most data: requests for the stream icon or metrics
+// are small, and only one stream runs at a time.
+int streamSocket(unsigned port)
+{
+    int best = -1;
+    uint64_t most = 0;
+    DIR* dir = opendir("/proc/self/fd");
+    if (!dir) {
+        return -1;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        int fd = atoi(entry->d_name);
+        if (fd <= 2 || fd == dirfd(dir)) {
+            continue;
+        }
+        struct sockaddr_storage local;
+        socklen_t len = sizeof(local);
+        if (getsockname(fd, (struct sockaddr*)&local, &len) != 0) {
+            continue;
+        }
+        unsigned localPort = 0;
+        if (local.ss_family == AF_INET) {
+            localPort = ntohs(((struct sockaddr_in*)&local)->sin_port);
+        } else if (local.ss_family == AF_INET6) {
+            localPort = ntohs(((struct sockaddr_in6*)&local)->sin6_port);
+        }
+        struct tcp_info info;
+        len = sizeof(info);
+        if (localPort != port || getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+            continue;
+        }
+        if (info.tcpi_state == 1 && info.tcpi_bytes_acked >= most) { // TCP_ESTABLISHED
+            most = info.tcpi_bytes_acked;
+            best = fd;
+        }
+    }
+    closedir(dir);
+    return best;
+}
+
+// Does not return: the process exits, leaving the connection to Sonos to the new one.
+void handOver(int s, unsigned port)
+{
+    printf("Handing over to the next process ... ");
+    fflush(stdout);
+
+    Header header = {};
+    header.magic = SBHANDOVER_MAGIC;
+    header.version = SBHANDOVER_VERSION;
+    header.codec = SBCodec::config().type;
+    header.kbps = SBCodec::config().kbps;
+
+    SBEncoderState state;
+    int fd = -1;
+    if (SBStreamer::detach(state)) {
+        header.parkedUs = sbtrace_now_us();
+        fd = streamSocket(port);
+    }
+    header.stream = get_squeezebox_stream_id();
+    if (fd >= 0) {
+        header.sampleSize = state.sampleSize;
+        header.leadMs = state.leadMs;
+        header.codecBytes = state.codec.size();
+        header.pendingBytes = state.pending.size();
+    }
+
+    struct iovec iov = { &header, sizeof(header) };
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    if (fd >= 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    bool ok = sendmsg(s, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(header)
+        && writeAll(s, state.codec.data(), header.codecBytes)
+        && writeAll(s, state.pending.data(), header.pendingBytes);
+    if (ok) {
+        sbtrace(SBT_HANDOVER, header.stream, header.pendingBytes, header.leadMs);
+        printf(fd >= 0 ? "SUCCESS (stream %u)\n" : "SUCCESS (no stream)\n", header.stream);
+    } else {
+        printf("FAILED\n");
+    }
+    fflush(stdout);
+    _exit(EXIT_SUCCESS); // no destructors: noson would close the connection that was handed over
+}
+}
+
+bool SBHandover::takeover(const std::string& path)
+{
+    struct sockaddr_un addr;
+    if (!address(path, addr)) {
+        return false;
+    }
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0) {
+        return false;
+    }
+    if (connect(s, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(s); // no previous process
+        return false;
+    }
+    printf("Taking over from the previous process ... ");
+    fflush(stdout);
+    struct timeval timeout = { SBHANDOVER_TIMEOUT_S, 0 };
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    Header header = {};
+    struct iovec iov = { &header, sizeof(header) };
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t r;
+    while ((r = recvmsg(s, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) { }
+    int fd = -1;
+    struct cmsghdr* cmsg = r > 0 ? CMSG_FIRSTHDR(&msg) : nullptr;
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    SBEncoderState state;
+    bool ok = r == (ssize_t)sizeof(header) && header.magic == SBHANDOVER_MAGIC && header.version == SBHANDOVER_VERSION
+        && readAll(s, state.codec, header.codecBytes) && readAll(s, state.pending, header.pendingBytes);
+
+    // the previous process exits once all is sent, which frees the HTTP port for noson
+    char c;
+    while ((r = recv(s, &c, 1, 0)) > 0 || (r < 0 && errno == EINTR)) { }
+    close(s);
+
+    if (!ok) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        printf("FAILED\n");
+        return false;
+    }
+    if (fd < 0 || header.codec != (uint32_t)SBCodec::config().type || header.kbps != SBCodec::config().kbps) {
+        // nothing playing, or a codec this process does not continue: Sonos gets a new stream
+        // once audio arrives, with an id it has not seen
+        if (fd >= 0) {
+            close(fd);
+        }
+        adopt_squeezebox_stream(header.stream, false);
+        printf("SUCCESS (no stream)\n");
+        return true;
+    }
+
+    state.sampleSize = (uint8_t)header.sampleSize;
+    state.leadMs = header.leadMs;
+    adopt_squeezebox_stream(header.stream, true); // before the encoder, which checks the stream id
+    SBEncoder* enc = new SBEncoder(header.stream);
+    if (!enc->resume(state)) {
+        delete enc;
+        close(fd);
+        adopt_squeezebox_stream(header.stream, false);
+        printf("FAILED to continue stream %u\n", header.stream);
+        return true;
+    }
+    sbmetrics_add(SBM_TAKEOVERS, 1);
+    sbtrace(SBT_TAKEOVER, header.stream, header.pendingBytes, header.leadMs);
+    std::thread(SBStreamer::resume, fd, enc, header.parkedUs).detach();
+    printf("SUCCESS (stream %u, %u ms queued)\n", header.stream, header.leadMs);
+    return true;
+}
+
+bool SBHandover::listen(const std::string& path, unsigned port)
+{
+    struct sockaddr_un addr;
+    if (!address(path, addr)) {
+        return false;
+    }
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0) {
+        return false;
+    }
+    unlink(path.c_str()); // left by the previous process
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 || chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0 || ::listen(s, 1) != 0) {
+        printf("Unable to listen for a handover on %s: %s\n", path.c_str(), strerror(errno));
+        close(s);
+        return false;
+    }
+    std::thread([s, port]() {
+        for (;;) {
+            int c = accept4(s, nullptr, nullptr, SOCK_CLOEXEC);
+            if (c >= 0) {
+                handOver(c, port);
+            }
+        }
+    }).detach();
+    return true;
+}
+
+void SBHandover::reexec(char** argv)
+{
+    long max = sysconf(_SC_OPEN_MAX);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // only the standard streams are passed on: the new process must not hold the HTTP port
+#ifdef SYS_close_range
+        if (syscall(SYS_close_range, 3, ~0U, 0) != 0)
+#endif
+            for (long fd = 3; fd < max; ++fd) {
+                close(fd);
+            }
+        execv("/proc/self/exe", argv);
+        _exit(127);
+    }
+    if (pid < 0) {
+        printf("Unable to start a new process: %s\n", strerror(errno));
+    }
+}
@@ -0,0 +1,48 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SBHANDOVER_H
+#define SBHANDOVER_H
+
+#include "local_config.h"
+
+#include <string>
+
+namespace NSROOT {
+
+// Restart without stopping the music on Sonos. A process started with --handover=<path> listens on
+// that Unix socket; a new process started with the same option (by hand, or from the old one on
+// SIGUSR2) connects to it before it binds the HTTP port. The old process then stops its stream
+// between two chunks, passes the connection Sonos pulls it from (SCM_RIGHTS), the encoder state
+// and the encoded audio not sent yet, and exits. The new process continues the same HTTP stream,
+// with silence until LMS sends audio to its squeezelite.
+class SBHandover {
+public:
+    // new process, before noson binds the HTTP port that the old one holds until it exits; returns
+    // true when a previous process handed over (with or without a stream)
+    static bool takeover(const std::string& path);
+    // old process: hands over to whoever connects to path, port is the HTTP port of the stream
+    static bool listen(const std::string& path, unsigned port);
+    // starts this binary again with the same arguments, which then takes over
+    static void reexec(char** argv);
+};
+}
+
+#endif /* SBHANDOVER_H */
@@ -0,0 +1,267 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "sbmetrics.h"
+#include "sbbudget.h"
+#include "sbsched.h"
+#include "sbtrace.h"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+
+#define SBMETRICS_PREFIX "sonos_squeezebox_"
+
+namespace {
+
+struct alignas(64) Metric {
+    std::atomic<int64_t> value { 0 };
+};
+
+struct Info {
+    const char* type;
+    const char* name;
+    const char* help;
+};
+
+const Info g_info[SBM_COUNT] = {
+#define SBMETRICS_INFO(name, type, metric, help) { #type, SBMETRICS_PREFIX metric, help },
+    SBMETRICS(SBMETRICS_INFO)
+#undef SBMETRICS_INFO
+};
+
+Metric g_metrics[SBM_COUNT];
+
+// time-to-first-byte histogram, upper bounds in ms
+const uint32_t g_ttfb_bounds[] = { 10, 25, 50, 100, 250, 500, 1000, 2500, 5000 };
+#define TTFB_BUCKETS (sizeof(g_ttfb_bounds) / sizeof(g_ttfb_bounds[0]))
+
+Metric g_ttfb[TTFB_BUCKETS + 1]; // last one is +Inf
+Metric g_ttfb_sum;
+
+// scheduling latency histogram per thread role, upper bounds in us
+const uint32_t g_latency_bounds[] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000 };
+#define LATENCY_BUCKETS (sizeof(g_latency_bounds) / sizeof(g_latency_bounds[0]))
+
+Metric g_latency[SBR_COUNT][LATENCY_BUCKETS + 1]; // last one is +Inf
+Metric g_latency_sum[SBR_COUNT];
+
+// skip in progress: us of the flush and the stream playing then (0 = none)
+#define SKIP_MAX_MS 10000 // longer is a stop followed by a new play, not a skip
+std::atomic<int64_t> g_skip_us { 0 };
+std::atomic<unsigned> g_skip_stream { 0 };
+
+const char* const g_start_labels[SBP_COUNT] = {
+#define SBSTART_LABEL(name, label) label,
+    SBSTART_PHASES(SBSTART_LABEL)
+#undef SBSTART_LABEL
+};
+
+// stream start in progress: us at which each phase was reached (0 = not yet)
+std::atomic<unsigned> g_start_stream { 0 };
+std::atomic<bool> g_start_done { true };
+Metric g_start_us[SBP_COUNT];
+// completed stream starts: ms since SBP_AUDIO, of the last one and summed over all
+Metric g_start_last_ms[SBP_COUNT];
+Metric g_start_sum_ms[SBP_COUNT];
+Metric g_start_count;
+
+void appendf(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+void appendf(std::string& out, const char* format, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    out.append(line);
+}
+
+void appendHeader(std::string& out, const char* name, const char* type, const char* help)
+{
+    appendf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+} // namespace
+
+extern "C" {
+
+void sbmetrics_add(sbmetric metric, int64_t value)
+{
+    g_metrics[metric].value.fetch_add(value, std::memory_order_relaxed);
+}
+
+void sbmetrics_set(sbmetric metric, int64_t value)
+{
+    g_metrics[metric].value.store(value, std::memory_order_relaxed);
+}
+
+int64_t sbmetrics_get(sbmetric metric)
+{
+    return g_metrics[metric].value.load(std::memory_order_relaxed);
+}
+
+void sbmetrics_ttfb(uint32_t ms)
+{
+    unsigned i = 0;
+    while (i < TTFB_BUCKETS && ms > g_ttfb_bounds[i]) {
+        ++i;
+    }
+    g_ttfb[i].value.fetch_add(1, std::memory_order_relaxed);
+    g_ttfb_sum.value.fetch_add(ms, std::memory_order_relaxed);
+}
+
+void sbmetrics_sched_latency(unsigned role, uint32_t us)
+{
+    unsigned i = 0;
+    while (i < LATENCY_BUCKETS && us > g_latency_bounds[i]) {
+        ++i;
+    }
+    g_latency[role][i].value.fetch_add(1, std::memory_order_relaxed);
+    g_latency_sum[role].value.fetch_add(us, std::memory_order_relaxed);
+}
+
+void sbmetrics_skip_flush(unsigned stream)
+{
+    g_skip_stream.store(stream);
+    g_skip_us.store((int64_t)sbtrace_now_us());
+    sbmetrics_add(SBM_SKIPS, 1);
+}
+
+void sbmetrics_skip_audio(unsigned stream)
+{
+    int64_t flushed = g_skip_us.load();
+    if (!flushed || stream <= g_skip_stream.load() || !g_skip_us.compare_exchange_strong(flushed, 0)) {
+        return;
+    }
+    int64_t ms = ((int64_t)sbtrace_now_us() - flushed) / 1000;
+    if (ms <= SKIP_MAX_MS) {
+        sbmetrics_set(SBM_SKIP_MS, ms);
+        sbmetrics_add(SBM_SKIP_MS_TOTAL, ms);
+        sbtrace(SBT_SKIP_DONE, stream, ms, 0);
+    }
+}
+
+void sbmetrics_start_phase(sbstart_phase phase, unsigned stream)
+{
+    int64_t now = (int64_t)sbtrace_now_us();
+    if (phase == SBP_AUDIO) {
+        for (int i = 0; i < SBP_COUNT; ++i) {
+            g_start_us[i].value.store(0, std::memory_order_relaxed);
+        }
+        g_start_stream.store(0);
+        g_start_us[SBP_AUDIO].value.store(now);
+        g_start_done.store(false);
+        return;
+    }
+    if (phase == SBP_STREAM_ID) {
+        g_start_stream.store(stream);
+    } else if (stream != g_start_stream.load()) {
+        return;
+    }
+    int64_t unset = 0;
+    if (!g_start_us[phase].value.compare_exchange_strong(unset, now)) {
+        return; // only the first GET (or reply) of a stream counts
+    }
+
+    // the PlayStream reply may arrive after the first byte, so complete when all phases are in
+    for (int i = 0; i < SBP_COUNT; ++i) {
+        if (!g_start_us[i].value.load()) {
+            return;
+        }
+    }
+    if (g_start_done.exchange(true)) {
+        return;
+    }
+    int64_t origin = g_start_us[SBP_AUDIO].value.load();
+    for (int i = 0; i < SBP_COUNT; ++i) {
+        int64_t ms = (g_start_us[i].value.load() - origin) / 1000;
+        g_start_last_ms[i].value.store(ms, std::memory_order_relaxed);
+        g_start_sum_ms[i].value.fetch_add(ms, std::memory_order_relaxed);
+    }
+    g_start_count.value.fetch_add(1, std::memory_order_relaxed);
+    sbtrace(SBT_STREAM_STARTED, stream, g_start_last_ms[SBP_FIRST_BYTE].value.load(),
+        g_start_last_ms[SBP_PLAY_REPLY].value.load() - g_start_last_ms[SBP_PLAY_REQUEST].value.load());
+}
+
+} // extern "C"
+
+std::string sbmetrics_render()
+{
+    std::string out;
+    sbmetrics_set(SBM_RESIDENT_BYTES, sbbudget_rss_bytes());
+    for (int i = 0; i < SBM_COUNT; ++i) {
+        appendHeader(out, g_info[i].name, g_info[i].type, g_info[i].help);
+        if (i == SBM_STREAM_ENCODED_BYTES) {
+            appendf(out, "%s{stream=\"%lld\"} %lld\n", g_info[i].name,
+                (long long)sbmetrics_get(SBM_STREAM_ID), (long long)sbmetrics_get((sbmetric)i));
+        } else {
+            appendf(out, "%s %lld\n", g_info[i].name, (long long)sbmetrics_get((sbmetric)i));
+        }
+    }
+
+    int64_t audio_us = sbmetrics_get(SBM_ENCODED_AUDIO_US);
+    int64_t encode_us = sbmetrics_get(SBM_ENCODE_US);
+    appendHeader(out, SBMETRICS_PREFIX "encode_realtime_factor", "gauge", "Audio duration encoded per second of encoding");
+    appendf(out, SBMETRICS_PREFIX "encode_realtime_factor %.1f\n", encode_us ? (double)audio_us / (double)encode_us : 0.0);
+
+    appendHeader(out, SBMETRICS_PREFIX "ttfb_milliseconds", "histogram", "Time from stream request to first byte sent");
+    uint64_t count = 0;
+    for (unsigned i = 0; i <= TTFB_BUCKETS; ++i) {
+        count += g_ttfb[i].value.load(std::memory_order_relaxed);
+        if (i < TTFB_BUCKETS) {
+            appendf(out, SBMETRICS_PREFIX "ttfb_milliseconds_bucket{le=\"%u\"} %llu\n", g_ttfb_bounds[i], (unsigned long long)count);
+        } else {
+            appendf(out, SBMETRICS_PREFIX "ttfb_milliseconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)count);
+        }
+    }
+    appendf(out, SBMETRICS_PREFIX "ttfb_milliseconds_sum %lld\n", (long long)g_ttfb_sum.value.load(std::memory_order_relaxed));
+    appendf(out, SBMETRICS_PREFIX "ttfb_milliseconds_count %llu\n", (unsigned long long)count);
+
+    appendHeader(out, SBMETRICS_PREFIX "sched_latency_microseconds", "histogram", "Time threads on the audio path woke up later than asked");
+    for (int role = 0; role < SBR_COUNT; ++role) {
+        const char* name = sbsched_name((sbsched_role)role);
+        count = 0;
+        for (unsigned i = 0; i <= LATENCY_BUCKETS; ++i) {
+            count += g_latency[role][i].value.load(std::memory_order_relaxed);
+            if (i < LATENCY_BUCKETS) {
+                appendf(out, SBMETRICS_PREFIX "sched_latency_microseconds_bucket{role=\"%s\",le=\"%u\"} %llu\n", name, g_latency_bounds[i], (unsigned long long)count);
+            } else {
+                appendf(out, SBMETRICS_PREFIX "sched_latency_microseconds_bucket{role=\"%s\",le=\"+Inf\"} %llu\n", name, (unsigned long long)count);
+            }
+        }
+        appendf(out, SBMETRICS_PREFIX "sched_latency_microseconds_sum{role=\"%s\"} %lld\n", name, (long long)g_latency_sum[role].value.load(std::memory_order_relaxed));
+        appendf(out, SBMETRICS_PREFIX "sched_latency_microseconds_count{role=\"%s\"} %llu\n", name, (unsigned long long)count);
+    }
+
+    appendHeader(out, SBMETRICS_PREFIX "stream_start_milliseconds", "gauge", "Time from non-silent audio to each step of the last stream start");
+    for (int i = 0; i < SBP_COUNT; ++i) {
+        appendf(out, SBMETRICS_PREFIX "stream_start_milliseconds{phase=\"%s\"} %lld\n", g_start_labels[i],
+            (long long)g_start_last_ms[i].value.load(std::memory_order_relaxed));
+    }
+    appendHeader(out, SBMETRICS_PREFIX "stream_start_milliseconds_total", "counter", "Time from non-silent audio to each step, summed over stream starts");
+    for (int i = 0; i < SBP_COUNT; ++i) {
+        appendf(out, SBMETRICS_PREFIX "stream_start_milliseconds_total{phase=\"%s\"} %lld\n", g_start_labels[i],
+            (long long)g_start_sum_ms[i].value.load(std::memory_order_relaxed));
+    }
+    appendHeader(out, SBMETRICS_PREFIX "stream_starts_measured_total", "counter", "Stream starts for which every step was seen");
+    appendf(out, SBMETRICS_PREFIX "stream_starts_measured_total %lld\n", (long long)g_start_count.value.load(std::memory_order_relaxed));
+    return out;
+}
@@ -0,0 +1,116 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SBMETRICS_H
+#define SBMETRICS_H
+
+// Counters and gauges for the /metrics endpoint. Every metric is a relaxed atomic on its own cache
+// line, written (almost always) by a single thread, so updating one never takes a lock.
+
+#include <stdint.h>
+
+#define SBMETRICS(X)                                                                                                           \
+    X(STREAM_ID, gauge, "stream_id", "Id of the current stream to the Sonos player")                                           \
+    X(STREAM_STARTS, counter, "stream_starts_total", "Streams started towards the Sonos player")                               \
+    X(STREAM_ENCODED_BYTES, gauge, "stream_encoded_bytes", "Encoded bytes of the current stream")                              \
+    X(ENCODED_BYTES, counter, "encoded_bytes_total", "Encoded bytes of all streams")                                           \
+    X(ENCODED_AUDIO_US, counter, "encoded_audio_microseconds_total", "Duration of the audio encoded")                          \
+    X(ENCODE_US, counter, "encode_microseconds_total", "Wall time spent encoding")                                             \
+    X(ENCODE_CPU_US, counter, "encode_cpu_microseconds_total", "CPU time spent encoding")                                      \
+    X(CODEC_KBPS, gauge, "codec_kbps", "Bitrate of the lossy codec, 0 for FLAC")                                               \
+    X(LEAD_MS, gauge, "lead_milliseconds", "Encoded audio ahead of playback")                                                  \
+    X(FRAMEBUFFER_BYTES, gauge, "framebuffer_bytes", "Encoded bytes queued for the HTTP stream")                               \
+    X(DROPPED_FRAMES, counter, "dropped_frames_total", "Encoded frames left out because the HTTP stream queue was full")       \
+    X(OUTPUTBUF_BYTES, gauge, "outputbuf_bytes", "Decoded bytes in the squeezelite output buffer")                             \
+    X(STREAMBUF_BYTES, gauge, "streambuf_bytes", "Undecoded bytes in the squeezelite stream buffer")                           \
+    X(UNDERRUNS, counter, "underruns_total", "Times the HTTP stream found no encoded data")                                    \
+    X(STALLS, counter, "stalls_total", "Encoder reads or writes that timed out")                                               \
+    X(HTTP_SEND_BLOCKED_US, counter, "http_send_blocked_microseconds_total", "Time spent sending to Sonos")                    \
+    X(HTTP_SENT_BYTES, counter, "http_sent_bytes_total", "Bytes sent to Sonos")                                                \
+    X(HTTP_REJECTED, counter, "http_rejected_total", "Stream requests rejected with 429")                                      \
+    X(STALL_RECOVERIES, counter, "stall_recoveries_total", "Streams restarted because Sonos stopped pulling")                  \
+    X(RECOVERY_MS, gauge, "recovery_milliseconds", "Time from stall to data flowing again, last recovery")                     \
+    X(RECOVERY_MS_TOTAL, counter, "recovery_milliseconds_total", "Time from stall to data flowing again")                      \
+    X(RESIDENT_BYTES, gauge, "resident_bytes", "Resident memory of this room")                                                 \
+    X(BUFFER_BYTES, gauge, "buffer_bytes", "Size of the squeezelite stream and output buffers")                                \
+    X(IDLE_RELEASES, counter, "idle_releases_total", "Times buffer memory was given back while idle")                          \
+    X(SKIPS, counter, "skips_total", "Playing audio flushed by a skip, seek or stop")                                          \
+    X(SKIP_RESTARTS, counter, "skip_restarts_total", "Flushes that started a new stream right away")                           \
+    X(SKIP_MS, gauge, "skip_milliseconds", "Time from flush to new audio queued for Sonos, last skip")                         \
+    X(SKIP_MS_TOTAL, counter, "skip_milliseconds_total", "Time from flush to new audio queued for Sonos")                      \
+    X(VOLUME_UPDATES, counter, "volume_updates_total", "Volume changes received from LMS")                                     \
+    X(VOLUME_SETS, counter, "volume_sets_total", "SetVolume requests sent to Sonos")                                           \
+    X(CONSTANT_FRAMES, counter, "constant_frames_total", "FLAC frames of silence written without the encoder")                 \
+    X(CONSTANT_SAVED_US, counter, "constant_saved_microseconds_total", "Encode time saved by constant FLAC frames, estimated") \
+    X(FLAC_SETUPS, counter, "flac_setups_total", "Times libFLAC was set up again after a silence")                             \
+    X(SOAP_CALLS, counter, "soap_requests_total", "UPnP control requests sent to Sonos")                                       \
+    X(SOAP_US, counter, "soap_microseconds_total", "Time from sending UPnP control requests to their replies")                 \
+    X(SOAP_LAST_US, gauge, "soap_last_microseconds", "Time the last UPnP control request (or pipelined batch) took")           \
+    X(SOAP_CONNECTS, counter, "soap_connects_total", "Connections opened for UPnP control")                                    \
+    X(SOAP_RETRIES, counter, "soap_retries_total", "UPnP control connections found closed by Sonos, requests sent again")      \
+    X(PIPELINE_MS, gauge, "pipeline_latency_milliseconds", "Decoded audio not yet played by Sonos: output buffer and lead")    \
+    X(TAKEOVERS, counter, "takeovers_total", "Streams taken over from a previous process")                                     \
+    X(HANDOVER_GAP_MS, gauge, "handover_gap_milliseconds", "Time the stream was not sent during the last takeover")
+
+typedef enum {
+#define SBMETRICS_ENUM(name, type, metric, help) SBM_##name,
+    SBMETRICS(SBMETRICS_ENUM)
+#undef SBMETRICS_ENUM
+        SBM_COUNT
+} sbmetric;
+
+// Steps from the first non-silent audio to the first byte sent to Sonos. Each is recorded as the
+// time since the first step, for the stream that was started last.
+#define SBSTART_PHASES(X)                     \
+    X(AUDIO, "silent_to_audio")               \
+    X(STREAM_ID, "stream_id")                 \
+    X(PLAY_REQUEST, "playstream_request")     \
+    X(PLAY_REPLY, "playstream_reply")         \
+    X(HTTP_GET, "http_get")                   \
+    X(FIRST_BYTE, "first_byte")
+
+typedef enum {
+#define SBSTART_ENUM(name, label) SBP_##name,
+    SBSTART_PHASES(SBSTART_ENUM)
+#undef SBSTART_ENUM
+        SBP_COUNT
+} sbstart_phase;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sbmetrics_add(sbmetric metric, int64_t value);
+void sbmetrics_set(sbmetric metric, int64_t value);
+int64_t sbmetrics_get(sbmetric metric);
+void sbmetrics_ttfb(uint32_t ms); // time from stream request to first byte sent
+void sbmetrics_start_phase(sbstart_phase phase, unsigned stream); // stream is ignored for SBP_AUDIO
+void sbmetrics_sched_latency(unsigned role, uint32_t us); // sbsched_role, wake-up later than asked
+void sbmetrics_skip_flush(unsigned stream); // playing audio of the stream was flushed
+void sbmetrics_skip_audio(unsigned stream); // first audio queued for a stream
+
+#ifdef __cplusplus
+} // extern "C"
+
+#include <string>
+
+std::string sbmetrics_render();
+#endif
+
+#endif /* SBMETRICS_H */
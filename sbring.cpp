@@ -0,0 +1,158 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "sbring.h"
+
+#include <cstring>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace NSROOT;
+
+namespace {
+std::mutex g_poolMutex;
+SBRing* g_pool[SBRING_POOL];
+unsigned g_pooled = 0;
+}
+
+SBRing::SBRing(size_t capacity)
+    : m_base(nullptr)
+    , m_size(0)
+    , m_mirrored(false)
+    , m_head(0)
+    , m_tail(0)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    m_size = (capacity + page - 1) / page * page;
+
+    int fd = memfd_create("sbring", MFD_CLOEXEC);
+    if (fd >= 0) {
+        // reserve both halves first, so nothing else can be mapped in between
+        char* base = (char*)mmap(nullptr, 2 * m_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base != MAP_FAILED) {
+            if (ftruncate(fd, m_size) == 0
+                && mmap(base, m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED
+                && mmap(base + m_size, m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED) {
+                m_base = base;
+                m_mirrored = true;
+            } else {
+                munmap(base, 2 * m_size);
+            }
+        }
+        close(fd); // the mappings keep the memory
+    }
+    if (!m_mirrored) {
+        m_base = new char[m_size];
+    }
+}
+
+SBRing::~SBRing()
+{
+    if (m_mirrored) {
+        munmap(m_base, 2 * m_size);
+    } else {
+        delete[] m_base;
+    }
+}
+
+SBRing* SBRing::acquire(size_t capacity)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (capacity + page - 1) / page * page;
+    {
+        std::lock_guard<std::mutex> lock(g_poolMutex);
+        for (unsigned i = 0; i < g_pooled; ++i) {
+            if (g_pool[i]->capacity() == size) {
+                SBRing* ring = g_pool[i];
+                g_pool[i] = g_pool[--g_pooled];
+                return ring;
+            }
+        }
+    }
+    return new SBRing(capacity);
+}
+
+void SBRing::release(SBRing* ring)
+{
+    ring->clear();
+    {
+        std::lock_guard<std::mutex> lock(g_poolMutex);
+        if (g_pooled < SBRING_POOL) {
+            g_pool[g_pooled++] = ring;
+            return;
+        }
+    }
+    delete ring;
+}
+
+void SBRing::trim()
+{
+    std::lock_guard<std::mutex> lock(g_poolMutex);
+    while (g_pooled) {
+        delete g_pool[--g_pooled];
+    }
+}
+
+size_t SBRing::write(const char* data, size_t len)
+{
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t space = m_size - (head - m_tail.load(std::memory_order_acquire));
+    if (len > space) {
+        return 0; // a part of a frame would corrupt the stream
+    }
+    size_t offset = head % m_size;
+    if (m_mirrored || offset + len <= m_size) {
+        memcpy(m_base + offset, data, len);
+    } else {
+        size_t first = m_size - offset;
+        memcpy(m_base + offset, data, first);
+        memcpy(m_base, data + first, len - first);
+    }
+    m_head.store(head + len, std::memory_order_release);
+    return len;
+}
+
+size_t SBRing::bytesAvailable() const
+{
+    return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_relaxed);
+}
+
+const char* SBRing::readSpan(size_t* len)
+{
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t available = m_head.load(std::memory_order_acquire) - tail;
+    size_t offset = tail % m_size;
+    if (!m_mirrored && offset + available > m_size) {
+        available = m_size - offset;
+    }
+    *len = available;
+    return m_base + offset;
+}
+
+void SBRing::consume(size_t len)
+{
+    m_tail.store(m_tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
+
+void SBRing::clear()
+{
+    m_head.store(0);
+    m_tail.store(0);
+}
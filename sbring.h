@@ -0,0 +1,69 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SBRING_H
+#define SBRING_H
+
+#include "local_config.h"
+
+#include <atomic>
+#include <cstddef>
+
+#define SBRING_POOL 2 // rings kept for later streams: the playing one and the next
+
+namespace NSROOT {
+
+// Single-producer/single-consumer byte ring for encoded audio. The memory is mapped twice, back to
+// back, so every readable span is contiguous however the data wraps. When memfd_create or the
+// mapping is not available a plain buffer is used and spans end at the wrap.
+class SBRing {
+public:
+    explicit SBRing(size_t capacity); // rounded up to whole pages
+    ~SBRing();
+
+    // A stream switch takes a ring from the pool instead of mapping a new one and gives it back
+    // when done, so the mapping and its pages are set up once. trim() unmaps the idle ones.
+    static SBRing* acquire(size_t capacity);
+    static void release(SBRing* ring);
+    static void trim();
+
+    size_t capacity() const { return m_size; }
+    bool mirrored() const { return m_mirrored; }
+
+    // producer
+    size_t write(const char* data, size_t len); // all of it or, when it does not fit, nothing: returns 0
+
+    // consumer
+    size_t bytesAvailable() const;
+    const char* readSpan(size_t* len); // contiguous readable bytes, valid until consume()
+    void consume(size_t len);
+
+    void clear(); // only while neither side is active
+
+private:
+    char* m_base;
+    size_t m_size;
+    bool m_mirrored;
+
+    alignas(64) std::atomic<size_t> m_head; // bytes written, ever
+    alignas(64) std::atomic<size_t> m_tail; // bytes consumed, ever
+};
+}
+
+#endif /* SBRING_H */
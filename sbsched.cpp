@@ -0,0 +1,234 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "sbsched.h"
+#include "sbmetrics.h"
+#include "sbtrace.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+#define POLICY_NICE -1 // not a kernel policy: SCHED_OTHER at a nice level
+
+struct Config {
+    bool set = false;
+    int policy = SCHED_OTHER;
+    int value = 0; // real-time priority or nice level
+    bool hasCpus = false;
+    cpu_set_t cpus;
+};
+
+const char* const g_names[SBR_COUNT] = {
+#define SBSCHED_NAME(name, label) label,
+    SBSCHED_ROLES(SBSCHED_NAME)
+#undef SBSCHED_NAME
+};
+
+Config g_config[SBR_COUNT];
+std::atomic<bool> g_warned[SBR_COUNT]; // HTTP workers apply on every stream, complain only once
+
+bool parseCpus(const char* list, cpu_set_t* set)
+{
+    CPU_ZERO(set);
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0) {
+            return false;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) {
+                return false;
+            }
+        }
+        if (last >= CPU_SETSIZE) {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            CPU_SET(cpu, set);
+        }
+        p = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') {
+            return false;
+        }
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+const char* policyName(int policy)
+{
+    switch (policy) {
+    case SCHED_FIFO:
+        return "SCHED_FIFO";
+    case SCHED_RR:
+        return "SCHED_RR";
+    case POLICY_NICE:
+        return "nice";
+    default:
+        return "SCHED_OTHER";
+    }
+}
+
+bool warnOnce(sbsched_role role)
+{
+    return !g_warned[role].exchange(true);
+}
+
+bool setNice(int nice)
+{
+    return setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) == 0; // per thread on Linux
+}
+
+} // namespace
+
+extern "C" {
+
+const char* sbsched_name(sbsched_role role)
+{
+    return g_names[role];
+}
+
+int sbsched_policy(sbsched_role role, const char* spec)
+{
+    Config& c = g_config[role];
+    const char* colon = strchr(spec, ':');
+    size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+    int value = colon ? atoi(colon + 1) : 0;
+    if (len == 4 && strncmp(spec, "fifo", len) == 0) {
+        c.policy = SCHED_FIFO;
+    } else if (len == 2 && strncmp(spec, "rr", len) == 0) {
+        c.policy = SCHED_RR;
+    } else if (len == 4 && strncmp(spec, "nice", len) == 0) {
+        c.policy = POLICY_NICE;
+    } else if (len == 5 && strncmp(spec, "other", len) == 0) {
+        c.policy = SCHED_OTHER;
+    } else {
+        return 0;
+    }
+    if (c.policy == SCHED_FIFO || c.policy == SCHED_RR) {
+        if (value < sched_get_priority_min(c.policy) || value > sched_get_priority_max(c.policy)) {
+            return 0;
+        }
+    } else if (c.policy == POLICY_NICE && (value < -20 || value > 19)) {
+        return 0;
+    }
+    c.value = value;
+    c.set = true;
+    return 1;
+}
+
+int sbsched_cpus(sbsched_role role, const char* list)
+{
+    Config& c = g_config[role];
+    c.hasCpus = parseCpus(list, &c.cpus);
+    return c.hasCpus;
+}
+
+int sbsched_process_cpus(const char* list)
+{
+    cpu_set_t cpus;
+    if (!parseCpus(list, &cpus)) {
+        return 0;
+    }
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (rc) {
+        printf("Scheduling: unable to run on CPUs %s (%s)\n", list, strerror(rc));
+    }
+    return 1;
+}
+
+void sbsched_apply(sbsched_role role)
+{
+    const Config& c = g_config[role];
+    if (c.hasCpus) {
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(c.cpus), &c.cpus);
+        if (rc && warnOnce(role)) {
+            printf("Scheduling: CPU affinity of the %s thread not set (%s)\n", g_names[role], strerror(rc));
+        }
+    }
+    if (!c.set) {
+        return;
+    }
+    if (c.policy == POLICY_NICE) {
+        if (!setNice(c.value) && warnOnce(role)) {
+            printf("Scheduling: nice %d not permitted for the %s thread (%s), keeping the default priority\n",
+                c.value, g_names[role], strerror(errno));
+        }
+        return;
+    }
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = c.value;
+    int rc = pthread_setschedparam(pthread_self(), c.policy, &param);
+    if (rc == 0 || c.policy == SCHED_OTHER) {
+        return;
+    }
+    // typically EPERM: no CAP_SYS_NICE and RLIMIT_RTPRIO too low
+    bool report = warnOnce(role);
+    if (report) {
+        printf("Scheduling: %s priority %d not permitted for the %s thread (%s), trying nice %d\n",
+            policyName(c.policy), c.value, g_names[role], strerror(rc), SBSCHED_FALLBACK_NICE);
+    }
+    if (!setNice(SBSCHED_FALLBACK_NICE) && report) {
+        printf("Scheduling: nice %d not permitted either (%s), keeping the default priority\n",
+            SBSCHED_FALLBACK_NICE, strerror(errno));
+    }
+}
+
+void sbsched_mlock(void)
+{
+    // Locking future mappings under a limited RLIMIT_MEMLOCK makes later allocations fail, so
+    // without privileges only what is mapped now (the squeezelite buffers) is locked.
+    struct rlimit limit;
+    int flags = MCL_CURRENT;
+    if (geteuid() == 0 || (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY)) {
+        flags |= MCL_FUTURE;
+    }
+    if (mlockall(flags)) {
+        printf("Scheduling: unable to lock memory (%s), audio buffers may be paged out\n", strerror(errno));
+    } else if (!(flags & MCL_FUTURE)) {
+        printf("Scheduling: current memory locked, buffers allocated later are not (RLIMIT_MEMLOCK %llu KB)\n",
+            (unsigned long long)limit.rlim_cur / 1024);
+    }
+}
+
+void sbsched_sleep_us(sbsched_role role, unsigned us)
+{
+    uint64_t begin = sbtrace_now_us();
+    usleep(us);
+    uint64_t slept = sbtrace_now_us() - begin;
+    sbmetrics_sched_latency(role, slept > us ? (uint32_t)(slept - us) : 0);
+}
+
+} // extern "C"
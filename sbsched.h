@@ -0,0 +1,57 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SBSCHED_H
+#define SBSCHED_H
+
+// Scheduling of the threads on the audio path. Each role can get a policy (SCHED_FIFO, SCHED_RR
+// or a nice level) and a set of CPUs. Missing privileges are reported once and the thread keeps
+// running with what it was allowed to have.
+
+#define SBSCHED_ROLES(X)                                                       \
+    X(OUTPUT, "output") /* squeezelite output thread, also runs the encoder */ \
+    X(HTTP, "http") /* noson worker serving the stream to Sonos */             \
+    X(MAIN, "main") /* polling loop issuing PlayStream */
+
+typedef enum {
+#define SBSCHED_ENUM(name, label) SBR_##name,
+    SBSCHED_ROLES(SBSCHED_ENUM)
+#undef SBSCHED_ENUM
+        SBR_COUNT
+} sbsched_role;
+
+#define SBSCHED_FALLBACK_NICE -10 // used when a real-time policy is not permitted
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char* sbsched_name(sbsched_role role);
+int sbsched_policy(sbsched_role role, const char* spec); // "fifo:<prio>", "rr:<prio>", "nice:<n>" or "other"
+int sbsched_cpus(sbsched_role role, const char* list); // "0-2,5"
+int sbsched_process_cpus(const char* list); // calling thread, inherited by threads started later
+void sbsched_apply(sbsched_role role); // from the thread itself
+void sbsched_mlock(void);
+void sbsched_sleep_us(sbsched_role role, unsigned us); // usleep() that records the wake-up latency
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* SBSCHED_H */
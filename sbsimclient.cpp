@@ -0,0 +1,605 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "sbsimclient.h"
+
+#include <FLAC++/decoder.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#define SIM_MIN_INPUT 32768 // more than the largest FLAC frame we can receive
+#define SIM_TIMEOUT_MS 10000
+#define SIM_POLL_MS 10
+
+static uint64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// decodes the received stream to validate it and to know how much audio was received
+class SonosSimClient::Decoder {
+public:
+    virtual ~Decoder() { }
+    virtual void restart() = 0; // the stream is requested again and starts over
+    virtual void feed(const std::string& data) = 0;
+    virtual void end() = 0;
+};
+
+class SonosSimClient::FlacDecoder : public SonosSimClient::Decoder, private FLAC::Decoder::Stream {
+public:
+    explicit FlacDecoder(SimStats& stats)
+        : m_stats(stats)
+        , m_pos(0)
+        , m_eof(false)
+    {
+        init();
+    }
+
+    void restart() override
+    {
+        finish();
+        m_in.clear();
+        m_pos = 0;
+        m_eof = false;
+        init();
+    }
+
+    void feed(const std::string& data) override
+    {
+        m_in.append(data);
+        decode();
+    }
+
+    void end() override
+    {
+        m_eof = true;
+        decode();
+    }
+
+protected:
+    FLAC__StreamDecoderReadStatus read_callback(FLAC__byte buffer[], size_t* bytes) override
+    {
+        size_t n = m_in.size() - m_pos;
+        if (n > *bytes) {
+            n = *bytes;
+        }
+        *bytes = n;
+        if (!n) {
+            return m_eof ? FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM : FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+        }
+        memcpy(buffer, m_in.data() + m_pos, n);
+        m_pos += n;
+        return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+    }
+
+    FLAC__StreamDecoderWriteStatus write_callback(const FLAC__Frame* frame, const FLAC__int32* const buffer[]) override
+    {
+        (void)buffer;
+        m_stats.frames += frame->header.blocksize;
+        m_stats.sampleRate = frame->header.sample_rate;
+        m_stats.bitsPerSample = frame->header.bits_per_sample;
+        return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+    }
+
+    void error_callback(FLAC__StreamDecoderErrorStatus status) override
+    {
+        (void)status;
+        ++m_stats.decodeErrors;
+    }
+
+private:
+    void decode()
+    {
+        while (m_eof ? m_pos < m_in.size() : m_in.size() - m_pos >= SIM_MIN_INPUT) {
+            FLAC__StreamDecoderState state = get_state();
+            if (state == FLAC__STREAM_DECODER_END_OF_STREAM || state == FLAC__STREAM_DECODER_ABORTED || !process_single()) {
+                break;
+            }
+        }
+        if (m_pos > 1024 * 1024) {
+            m_in.erase(0, m_pos);
+            m_pos = 0;
+        }
+    }
+
+    SimStats& m_stats;
+    std::string m_in;
+    size_t m_pos;
+    bool m_eof;
+};
+
+// Walks the MP3 frame headers: enough to check the framing and to count the audio, without
+// decoding the audio itself.
+class SonosSimClient::Mp3Decoder : public SonosSimClient::Decoder {
+public:
+    explicit Mp3Decoder(SimStats& stats)
+        : m_stats(stats)
+        , m_pos(0)
+        , m_synced(false)
+    {
+    }
+
+    void restart() override
+    {
+        m_in.clear();
+        m_pos = 0;
+        m_synced = false;
+    }
+
+    void feed(const std::string& data) override
+    {
+        m_in.append(data);
+        parse();
+    }
+
+    void end() override
+    {
+        // a partial frame left over is not an error: --duration cuts streams off anywhere
+    }
+
+private:
+    void parse()
+    {
+        static const unsigned kbpsV1[16] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 };
+        static const unsigned kbpsV2[16] = { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 };
+        static const unsigned rates[4] = { 44100, 48000, 32000, 0 };
+
+        while (m_in.size() - m_pos >= 4) {
+            const unsigned char* h = (const unsigned char*)m_in.data() + m_pos;
+            unsigned version = (h[1] >> 3) & 3; // 3 = MPEG-1, 2 = MPEG-2, 0 = MPEG-2.5
+            unsigned layer = (h[1] >> 1) & 3; // 1 = layer III
+            unsigned kbps = (version == 3 ? kbpsV1 : kbpsV2)[h[2] >> 4];
+            unsigned rate = rates[(h[2] >> 2) & 3] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+            if (h[0] != 0xff || (h[1] & 0xe0) != 0xe0 || version == 1 || layer != 1 || !kbps || !rate) {
+                if (m_synced) {
+                    m_synced = false;
+                    ++m_stats.decodeErrors;
+                }
+                ++m_pos;
+                continue;
+            }
+            size_t length = (version == 3 ? 144 : 72) * kbps * 1000 / rate + ((h[2] >> 1) & 1);
+            if (m_in.size() - m_pos < length) {
+                break;
+            }
+            m_stats.frames += version == 3 ? 1152 : 576;
+            m_stats.sampleRate = rate;
+            m_stats.bitsPerSample = 16;
+            m_pos += length;
+            m_synced = true;
+        }
+        if (m_pos > 1024 * 1024) {
+            m_in.erase(0, m_pos);
+            m_pos = 0;
+        }
+    }
+
+    SimStats& m_stats;
+    std::string m_in;
+    size_t m_pos;
+    bool m_synced;
+};
+
+
+// validates and removes the chunked transfer-encoding framing
+class SonosSimClient::Dechunker {
+public:
+    bool feed(const char* data, size_t len, std::string& out)
+    {
+        for (size_t i = 0; i < len; ++i) {
+            char c = data[i];
+            switch (m_state) {
+            case SIZE:
+                if (c != '\n') {
+                    m_line += c;
+                    if (m_line.length() > 32) {
+                        return false;
+                    }
+                    break;
+                }
+                if (!parseSize()) {
+                    return false;
+                }
+                m_state = m_remaining ? DATA : TRAILER;
+                break;
+            case DATA: {
+                size_t n = len - i < m_remaining ? len - i : m_remaining;
+                out.append(data + i, n);
+                m_remaining -= n;
+                i += n - 1;
+                if (!m_remaining) {
+                    m_state = DATA_CR;
+                }
+                break;
+            }
+            case DATA_CR:
+                if (c != '\r') {
+                    return false;
+                }
+                m_state = DATA_LF;
+                break;
+            case DATA_LF:
+                if (c != '\n') {
+                    return false;
+                }
+                m_state = SIZE;
+                break;
+            case TRAILER:
+                if (c != '\n') {
+                    m_line += c;
+                } else if (m_line.empty() || m_line == "\r") {
+                    m_state = DONE;
+                } else {
+                    m_line.clear(); // trailer header, ignored
+                }
+                break;
+            case DONE:
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool done() const { return m_state == DONE; }
+
+    void reset()
+    {
+        m_state = SIZE;
+        m_line.clear();
+        m_remaining = 0;
+    }
+
+private:
+    bool parseSize()
+    {
+        std::string line = m_line.substr(0, m_line.find_first_of(";\r"));
+        m_line.clear();
+        if (line.empty() || line.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+            return false;
+        }
+        m_remaining = strtoul(line.c_str(), 0, 16);
+        return true;
+    }
+
+    enum {
+        SIZE,
+        DATA,
+        DATA_CR,
+        DATA_LF,
+        TRAILER,
+        DONE
+    } m_state
+        = SIZE;
+    std::string m_line;
+    size_t m_remaining = 0;
+};
+
+SonosSimClient::SonosSimClient(const std::string& url, const SimOptions& options)
+    : m_url(url)
+    , m_options(options)
+    , m_stats()
+    , m_stop(false)
+    , m_decoder(nullptr)
+{
+}
+
+SonosSimClient::~SonosSimClient()
+{
+    delete m_decoder;
+}
+
+bool SonosSimClient::parseUrl()
+{
+    if (m_url.compare(0, 7, "http://") != 0) {
+        return false;
+    }
+    size_t p = m_url.find('/', 7);
+    std::string hostport = m_url.substr(7, p == std::string::npos ? std::string::npos : p - 7);
+    m_path = p == std::string::npos ? "/" : m_url.substr(p);
+    size_t c = hostport.rfind(':');
+    m_host = hostport.substr(0, c);
+    m_port = c == std::string::npos ? "80" : hostport.substr(c + 1);
+    return !m_host.empty();
+}
+
+int SonosSimClient::connectServer()
+{
+    struct addrinfo hints;
+    struct addrinfo* res = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(m_host.c_str(), m_port.c_str(), &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// sends the request and reads the response header, returns the HTTP status or -1
+int SonosSimClient::request(int fd, const char* method, std::string& headers, std::string& rest)
+{
+    std::string req;
+    req.append(method).append(" ").append(m_path).append(" HTTP/1.1\r\n")
+        .append("Host: ").append(m_host).append(":").append(m_port).append("\r\n")
+        .append("User-Agent: Linux UPnP/1.0 Sonos/70.3 (sonos-sim)\r\n")
+        .append("Connection: close\r\n")
+        .append("\r\n");
+    if (send(fd, req.c_str(), req.length(), MSG_NOSIGNAL) != (ssize_t)req.length()) {
+        return -1;
+    }
+    std::string in;
+    size_t end;
+    while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        char buf[4096];
+        if (poll(&pfd, 1, SIM_TIMEOUT_MS) <= 0) {
+            return -1;
+        }
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return -1;
+        }
+        in.append(buf, n);
+    }
+    headers = in.substr(0, end + 2);
+    rest = in.substr(end + 4);
+    int status = 0;
+    if (sscanf(headers.c_str(), "HTTP/1.%*d %d", &status) != 1) {
+        return -1;
+    }
+    return status;
+}
+
+static std::string headerValue(const std::string& headers, const char* name)
+{
+    size_t len = strlen(name);
+    for (size_t p = 0; p < headers.length();) {
+        size_t eol = headers.find("\r\n", p);
+        if (eol == std::string::npos) {
+            eol = headers.length();
+        }
+        if (eol - p > len && strncasecmp(headers.c_str() + p, name, len) == 0 && headers[p + len] == ':') {
+            size_t v = headers.find_first_not_of(' ', p + len + 1);
+            return headers.substr(v, eol - v);
+        }
+        p = eol + 2;
+    }
+    return std::string();
+}
+
+bool SonosSimClient::run()
+{
+    if (!parseUrl()) {
+        printf("sonos-sim: invalid url %s\n", m_url.c_str());
+        return false;
+    }
+    uint64_t start = nowUs();
+
+    if (m_options.head) {
+        int fd = connectServer();
+        if (fd >= 0) {
+            std::string headers, rest;
+            m_stats.headStatus = request(fd, "HEAD", headers, rest);
+            m_stats.contentType = headerValue(headers, "Content-Type");
+            close(fd);
+        }
+    }
+
+    std::thread* duplicate = nullptr;
+    if (m_options.duplicate) {
+        duplicate = new std::thread([this]() {
+            usleep(200000); // once the first request is being served
+            int fd = connectServer();
+            if (fd >= 0) {
+                std::string headers, rest;
+                m_stats.duplicateStatus = request(fd, "GET", headers, rest);
+                close(fd);
+            }
+        });
+    }
+
+    bool ok = stream(start);
+
+    if (duplicate) {
+        duplicate->join();
+        delete duplicate;
+    }
+    m_stats.seconds = (nowUs() - start) / 1e6;
+    return ok;
+}
+
+bool SonosSimClient::stream(uint64_t startUs)
+{
+    Dechunker dechunker;
+    std::string payload;
+    uint64_t getUs = 0;
+    bool eof = false;
+
+    auto open = [&]() -> int {
+        int fd = connectServer();
+        if (fd < 0) {
+            m_stats.getStatus = -1;
+            return -1;
+        }
+        std::string headers, rest;
+        getUs = nowUs();
+        m_stats.getStatus = request(fd, "GET", headers, rest);
+        if (m_stats.getStatus != 200 || headerValue(headers, "Transfer-Encoding") != "chunked") {
+            if (m_stats.getStatus == 200) {
+                ++m_stats.chunkErrors;
+            }
+            close(fd);
+            return -1;
+        }
+        if (!m_decoder) {
+            m_stats.contentType = headerValue(headers, "Content-Type");
+            if (m_stats.contentType == "audio/mpeg") {
+                m_decoder = new Mp3Decoder(m_stats);
+            } else {
+                m_decoder = new FlacDecoder(m_stats);
+            }
+        }
+        if (!rest.empty()) {
+            m_stats.ttfbMs = (nowUs() - getUs) / 1000;
+            getUs = 0;
+            payload.clear();
+            if (!dechunker.feed(rest.data(), rest.length(), payload)) {
+                ++m_stats.chunkErrors;
+            }
+            m_stats.bytes += payload.length();
+            m_decoder->feed(payload);
+        }
+        return fd;
+    };
+
+    int fd = open();
+    if (fd < 0) {
+        return false;
+    }
+
+    unsigned seed = (unsigned)startUs;
+    uint64_t lastUs = nowUs();
+    uint64_t playedUs = 0;
+    bool playing = false;
+    uint64_t leadSum = 0;
+    uint64_t leadCount = 0;
+    uint64_t nextStallUs = m_options.stallEveryS ? startUs + m_options.stallEveryS * 1000000ULL : 0;
+    uint64_t stallUntilUs = 0;
+    uint64_t reconnectUs = m_options.reconnectAfterS ? startUs + m_options.reconnectAfterS * 1000000ULL : 0;
+
+    while (!m_stop && !eof) {
+        uint64_t now = nowUs();
+        if (m_options.durationS && now - startUs >= m_options.durationS * 1000000ULL) {
+            break;
+        }
+
+        // simulated playback
+        uint64_t receivedUs = m_stats.frames * 1000000 / (m_stats.sampleRate ? m_stats.sampleRate : 44100);
+        if (playing) {
+            playedUs += now - lastUs;
+            if (playedUs >= receivedUs) {
+                ++m_stats.underruns;
+                playedUs = receivedUs;
+                playing = false;
+            } else {
+                int lead = (int)((receivedUs - playedUs) / 1000);
+                if (m_stats.minLeadMs < 0 || lead < m_stats.minLeadMs) {
+                    m_stats.minLeadMs = lead;
+                }
+                leadSum += lead;
+                ++leadCount;
+            }
+        } else if (receivedUs - playedUs >= m_options.startMs * 1000ULL) {
+            playing = true;
+        }
+        lastUs = now;
+
+        if (reconnectUs && now >= reconnectUs) {
+            reconnectUs = 0;
+            close(fd);
+            ++m_stats.reconnects;
+            dechunker.reset();
+            m_decoder->restart();
+            if ((fd = open()) < 0) {
+                return false;
+            }
+            continue;
+        }
+
+        if (nextStallUs && now >= nextStallUs) {
+            stallUntilUs = now + m_options.stallMs * 1000ULL;
+            nextStallUs += m_options.stallEveryS * 1000000ULL;
+        }
+        if (now < stallUntilUs || receivedUs - playedUs >= m_options.bufferMs * 1000ULL) {
+            usleep(SIM_POLL_MS * 1000);
+            continue;
+        }
+        if (m_options.jitterMs) {
+            usleep((rand_r(&seed) % m_options.jitterMs) * 1000);
+        }
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, SIM_POLL_MS) <= 0) {
+            continue;
+        }
+        char buf[16384];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            eof = true;
+            break;
+        }
+        if (getUs) {
+            m_stats.ttfbMs = (nowUs() - getUs) / 1000;
+            getUs = 0;
+        }
+        payload.clear();
+        if (!dechunker.feed(buf, n, payload)) {
+            ++m_stats.chunkErrors;
+            eof = true;
+        }
+        m_stats.bytes += payload.length();
+        m_decoder->feed(payload);
+        if (dechunker.done()) {
+            eof = true;
+        }
+    }
+    close(fd);
+    m_decoder->end();
+    m_stats.completed = dechunker.done();
+    m_stats.avgLeadMs = leadCount ? (double)leadSum / leadCount : 0;
+    return m_stats.chunkErrors == 0 && m_stats.decodeErrors == 0;
+}
+
+void SonosSimClient::printHeader()
+{
+    printf("+-------------------------------------------------------------------------------------------------------+\n");
+    printf("| %-12s | %4s | %4s | %7s | %8s | %8s | %7s | %9s | %8s | %8s | %6s |\n",
+        "room", "HEAD", "GET", "ttfb ms", "MB", "audio s", "kbit/s", "underruns", "min lead", "avg lead", "errors");
+    printf("+-------------------------------------------------------------------------------------------------------+\n");
+}
+
+void SonosSimClient::printStats(const char* name) const
+{
+    double audio = m_stats.frames / (double)(m_stats.sampleRate ? m_stats.sampleRate : 44100);
+    printf("| %-12s | %4d | %4d | %7u | %8.2f | %8.1f | %7.0f | %9u | %8d | %8.0f | %6u |\n",
+        name, m_stats.headStatus, m_stats.getStatus, m_stats.ttfbMs, m_stats.bytes / 1e6, audio,
+        m_stats.seconds > 0 ? m_stats.bytes * 8 / m_stats.seconds / 1000 : 0.0,
+        m_stats.underruns, m_stats.minLeadMs, m_stats.avgLeadMs, m_stats.chunkErrors + m_stats.decodeErrors);
+}
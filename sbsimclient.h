@@ -0,0 +1,98 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SBSIMCLIENT_H
+#define SBSIMCLIENT_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// A stand-in for a Sonos player pulling /music/squeezebox.flac (or .mp3): HEAD, then GET with
+// chunked transfer, decoding the stream into a simulated playback buffer. After an initial burst the
+// buffer is only topped up as playback consumes it, so the server sees a real-time pull.
+
+struct SimOptions {
+    unsigned startMs = 2000; // buffered audio needed before playback (re)starts
+    unsigned bufferMs = 6000; // maximum buffered audio, reading pauses above this
+    unsigned durationS = 0; // stop after this many seconds, 0 = until the stream ends
+    unsigned jitterMs = 0; // random delay before each read
+    unsigned stallEveryS = 0; // stop reading every N seconds ...
+    unsigned stallMs = 0; // ... for this long
+    unsigned reconnectAfterS = 0; // drop the connection and request the stream again
+    bool duplicate = false; // issue a second GET for the same stream, as Sonos sometimes does
+    bool head = true;
+};
+
+struct SimStats {
+    int headStatus = 0;
+    int getStatus = 0;
+    int duplicateStatus = 0;
+    std::string contentType;
+    uint32_t ttfbMs = 0; // GET sent to first body byte
+    uint64_t bytes = 0; // payload bytes after de-chunking
+    uint64_t frames = 0; // decoded audio frames
+    unsigned sampleRate = 0;
+    unsigned bitsPerSample = 0;
+    unsigned underruns = 0;
+    unsigned chunkErrors = 0;
+    unsigned decodeErrors = 0;
+    unsigned reconnects = 0;
+    int minLeadMs = -1;
+    double avgLeadMs = 0;
+    double seconds = 0;
+    bool completed = false; // terminating chunk received
+};
+
+class SonosSimClient {
+public:
+    SonosSimClient(const std::string& url, const SimOptions& options);
+    ~SonosSimClient();
+
+    bool run(); // blocks until the stream ends, the duration expires or stop() is called
+    void stop() { m_stop = true; }
+    const SimStats& stats() const { return m_stats; }
+    const std::string& url() const { return m_url; }
+
+    static void printHeader();
+    void printStats(const char* name) const;
+
+private:
+    class Decoder;
+    class FlacDecoder;
+    class Mp3Decoder;
+    class Dechunker;
+
+    bool parseUrl();
+    int connectServer();
+    int request(int fd, const char* method, std::string& headers, std::string& rest);
+    bool stream(uint64_t startUs);
+
+    std::string m_url;
+    std::string m_host;
+    std::string m_port;
+    std::string m_path;
+    SimOptions m_options;
+    SimStats m_stats;
+    std::atomic<bool> m_stop;
+    Decoder* m_decoder;
+};
+
+#endif /* SBSIMCLIENT_H */
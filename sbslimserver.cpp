@@ -0,0 +1,386 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "sbslimserver.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define SLIM_HEARTBEAT_MS 5000
+#define SLIM_THRESHOLD_KB 32
+#define HTTP_CHUNK 4096
+
+static bool readAll(int fd, char* buf, size_t len)
+{
+    while (len) {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool sendAll(int fd, const char* buf, size_t len)
+{
+    while (len) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static int listenOn(unsigned port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+        printf("lms-sim: unable to listen on port %u\n", port);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+uint64_t SlimServerSim::nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SlimServerSim::SlimServerSim(unsigned slimPort, unsigned httpPort)
+    : m_slimPort(slimPort)
+    , m_httpPort(httpPort)
+    , m_rateKbps(0)
+    , m_slimListen(-1)
+    , m_httpListen(-1)
+    , m_player(-1)
+    , m_running(false)
+    , m_slim(nullptr)
+    , m_http(nullptr)
+    , m_heartbeat(nullptr)
+{
+}
+
+SlimServerSim::~SlimServerSim()
+{
+    stop();
+}
+
+bool SlimServerSim::start()
+{
+    m_slimListen = listenOn(m_slimPort);
+    m_httpListen = listenOn(m_httpPort);
+    if (m_slimListen < 0 || m_httpListen < 0) {
+        return false;
+    }
+    m_running = true;
+    m_slim = new std::thread(&SlimServerSim::slimThread, this);
+    m_http = new std::thread(&SlimServerSim::httpThread, this);
+    m_heartbeat = new std::thread(&SlimServerSim::heartbeatThread, this);
+    return true;
+}
+
+void SlimServerSim::stop()
+{
+    if (!m_running) {
+        return;
+    }
+    m_running = false;
+    shutdown(m_slimListen, SHUT_RDWR);
+    shutdown(m_httpListen, SHUT_RDWR);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_player >= 0) {
+            shutdown(m_player, SHUT_RDWR);
+        }
+    }
+    m_cond.notify_all();
+    for (std::thread** t : { &m_slim, &m_http, &m_heartbeat }) {
+        (*t)->join();
+        delete *t;
+        *t = nullptr;
+    }
+    close(m_slimListen);
+    close(m_httpListen);
+}
+
+int SlimServerSim::addTrack(const std::string& path)
+{
+    Track t;
+    t.path = path;
+    std::string ext = path.substr(path.rfind('.') + 1);
+    if (ext == "flac") {
+        t.codec = "flac";
+        t.format = 'f';
+    } else if (ext == "mp3") {
+        t.codec = "mp3";
+        t.format = 'm';
+    } else {
+        t.codec = "pcm"; // .wav is parsed by squeezelite, anything else is raw s16le stereo 44k1
+        t.format = 'p';
+    }
+    m_tracks.push_back(t);
+    return (int)m_tracks.size() - 1;
+}
+
+const std::string& SlimServerSim::trackCodec(int track) const
+{
+    return m_tracks[track].codec;
+}
+
+bool SlimServerSim::waitForPlayer(unsigned timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_cond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() { return !m_mac.empty() || !m_running; }) && m_running;
+}
+
+std::string SlimServerSim::playerMac() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_mac;
+}
+
+uint64_t SlimServerSim::play(int track)
+{
+    return sendStrm('s', '1', track, 0);
+}
+
+uint64_t SlimServerSim::pause()
+{
+    return sendStrm('p', '0', -1, 0);
+}
+
+uint64_t SlimServerSim::unpause()
+{
+    return sendStrm('u', '0', -1, 0);
+}
+
+uint64_t SlimServerSim::stopPlayback()
+{
+    return sendStrm('q', '0', -1, 0);
+}
+
+uint64_t SlimServerSim::skip(int track)
+{
+    uint64_t us = sendStrm('q', '0', -1, 0);
+    sendStrm('s', '1', track, 0);
+    return us;
+}
+
+uint64_t SlimServerSim::waitForEvent(const char* event, uint64_t sinceUs, unsigned timeoutMs)
+{
+    uint64_t at = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&]() {
+        for (const Event& ev : m_events) {
+            if (ev.us >= sinceUs && ev.name == event) {
+                at = ev.us;
+                return true;
+            }
+        }
+        return !m_running;
+    });
+    return at;
+}
+
+// strm: command, autostart, format, pcm sample size/rate/channels/endianness, threshold,
+// spdif, transition period/type, flags, output threshold, slaves, replay gain (or interval),
+// server port, server ip (0 = this server), followed by the HTTP request for 's'
+uint64_t SlimServerSim::sendStrm(char command, char autostart, int track, uint32_t interval)
+{
+    std::string p(24, '\0');
+    p[0] = command;
+    p[1] = autostart;
+    p[2] = p[3] = p[4] = p[5] = p[6] = '?';
+    if (track >= 0) {
+        const Track& t = m_tracks[track];
+        p[2] = t.format;
+        if (t.format == 'p' && t.path.substr(t.path.rfind('.') + 1) != "wav") {
+            p[3] = '1'; // 16 bit
+            p[4] = '3'; // 44.1 kHz
+            p[5] = '2'; // stereo
+            p[6] = '1'; // little endian
+        }
+    }
+    p[7] = SLIM_THRESHOLD_KB;
+    p[8] = '0';
+    p[10] = '0';
+    uint32_t gain = htonl(interval);
+    memcpy(&p[14], &gain, 4);
+    uint16_t port = htons(m_httpPort);
+    memcpy(&p[18], &port, 2);
+    if (command == 's') {
+        p.append("GET /stream/" + std::to_string(track) + " HTTP/1.0\r\n\r\n");
+    }
+    uint64_t us = nowUs();
+    sendMessage("strm", p);
+    return us;
+}
+
+bool SlimServerSim::sendMessage(const char* opcode, const std::string& payload)
+{
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        fd = m_player;
+    }
+    if (fd < 0) {
+        return false;
+    }
+    std::string msg(2, '\0');
+    uint16_t len = htons(4 + payload.length());
+    memcpy(&msg[0], &len, 2);
+    msg.append(opcode, 4).append(payload);
+    std::lock_guard<std::mutex> lock(m_send_mutex);
+    return sendAll(fd, msg.data(), msg.length());
+}
+
+void SlimServerSim::slimThread()
+{
+    while (m_running) {
+        int fd = accept(m_slimListen, 0, 0);
+        if (fd < 0) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_player = fd;
+        }
+        char header[8];
+        std::string payload;
+        while (readAll(fd, header, 8)) {
+            uint32_t len;
+            memcpy(&len, header + 4, 4);
+            payload.resize(ntohl(len));
+            if (!readAll(fd, &payload[0], payload.length())) {
+                break;
+            }
+            Event ev;
+            ev.us = nowUs();
+            ev.name.assign(header, 4);
+            if (ev.name == "STAT" && payload.length() >= 4) {
+                ev.name = payload.substr(0, 4);
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (ev.name == "HELO" && payload.length() >= 8) {
+                char mac[18];
+                const unsigned char* m = (const unsigned char*)payload.data() + 2;
+                snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x", m[0], m[1], m[2], m[3], m[4], m[5]);
+                m_mac = mac;
+            }
+            if (ev.name != "STMt") {
+                m_events.push_back(ev);
+            }
+            m_cond.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_player = -1;
+        m_events.push_back(Event { "DISC", nowUs() });
+        m_cond.notify_all();
+        close(fd);
+    }
+}
+
+void SlimServerSim::heartbeatThread()
+{
+    while (m_running) {
+        sendStrm('t', '0', -1, (uint32_t)(nowUs() / 1000));
+        for (unsigned ms = 0; ms < SLIM_HEARTBEAT_MS && m_running; ms += 100) {
+            usleep(100000);
+        }
+    }
+}
+
+void SlimServerSim::httpThread()
+{
+    while (m_running) {
+        int fd = accept(m_httpListen, 0, 0);
+        if (fd >= 0) {
+            std::thread(&SlimServerSim::serveFile, this, fd).detach();
+        }
+    }
+}
+
+void SlimServerSim::serveFile(int fd)
+{
+    std::string req;
+    char buf[HTTP_CHUNK];
+    while (req.find("\r\n\r\n") == std::string::npos) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            close(fd);
+            return;
+        }
+        req.append(buf, n);
+    }
+    int track = -1;
+    FILE* f = nullptr;
+    if (sscanf(req.c_str(), "GET /stream/%d", &track) == 1 && track >= 0 && track < (int)m_tracks.size()) {
+        f = fopen(m_tracks[track].path.c_str(), "rb");
+    }
+    if (!f) {
+        const char* resp = "HTTP/1.0 404 Not Found\r\n\r\n";
+        sendAll(fd, resp, strlen(resp));
+        close(fd);
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    const char* mime = m_tracks[track].format == 'f' ? "audio/flac" : m_tracks[track].format == 'm' ? "audio/mpeg" : "audio/L16";
+    std::string resp = "HTTP/1.0 200 OK\r\nServer: lms-sim\r\nContent-Type: " + std::string(mime)
+        + "\r\nContent-Length: " + std::to_string(size) + "\r\n\r\n";
+    bool ok = sendAll(fd, resp.data(), resp.length());
+
+    uint64_t start = nowUs();
+    uint64_t sent = 0;
+    size_t n;
+    while (ok && m_running && (n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        unsigned kbps = m_rateKbps;
+        if (kbps) {
+            uint64_t due = start + sent * 8000 / kbps;
+            uint64_t now = nowUs();
+            if (due > now) {
+                usleep(due - now);
+            }
+        }
+        ok = sendAll(fd, buf, n);
+        sent += n;
+    }
+    fclose(f);
+    close(fd);
+}
@@ -0,0 +1,100 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SBSLIMSERVER_H
+#define SBSLIMSERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A minimal Logitech Media Server stand-in: speaks enough slimproto to control one squeezelite
+// player (strm start/pause/unpause/stop and status requests) and serves audio files over HTTP at
+// a controllable rate. Player STAT events are recorded with their arrival time so command to
+// acknowledgement latency can be measured.
+
+class SlimServerSim {
+public:
+    SlimServerSim(unsigned slimPort = 3483, unsigned httpPort = 9000);
+    ~SlimServerSim();
+
+    bool start();
+    void stop();
+
+    int addTrack(const std::string& path); // returns the track index
+    const std::string& trackCodec(int track) const;
+    void setRate(unsigned kbps) { m_rateKbps = kbps; } // 0 = unlimited
+
+    bool waitForPlayer(unsigned timeoutMs);
+    std::string playerMac() const;
+
+    // each returns the time the command was sent (us, CLOCK_MONOTONIC)
+    uint64_t play(int track);
+    uint64_t pause();
+    uint64_t unpause();
+    uint64_t stopPlayback();
+    uint64_t skip(int track);
+
+    // waits for a STAT event (e.g. "STMs") received after sinceUs, returns its arrival time or 0
+    uint64_t waitForEvent(const char* event, uint64_t sinceUs, unsigned timeoutMs);
+
+    static uint64_t nowUs();
+
+private:
+    struct Track {
+        std::string path;
+        std::string codec;
+        char format;
+    };
+    struct Event {
+        std::string name;
+        uint64_t us;
+    };
+
+    uint64_t sendStrm(char command, char autostart, int track, uint32_t interval);
+    bool sendMessage(const char* opcode, const std::string& payload);
+    void slimThread();
+    void httpThread();
+    void serveFile(int fd);
+    void heartbeatThread();
+
+    unsigned m_slimPort;
+    unsigned m_httpPort;
+    std::atomic<unsigned> m_rateKbps;
+    int m_slimListen;
+    int m_httpListen;
+    int m_player;
+    std::atomic<bool> m_running;
+    std::string m_mac;
+    std::vector<Track> m_tracks;
+    std::vector<Event> m_events;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::mutex m_send_mutex;
+    std::thread* m_slim;
+    std::thread* m_http;
+    std::thread* m_heartbeat;
+};
+
+#endif /* SBSLIMSERVER_H */
@@ -24,18 +24,26 @@
 #include "private/tokenizer.h"
 #include "private/urlencoder.h"
 #include "requestbroker.h"
+#include "sbbudget.h"
+#include "sbcodec.h"
 #include "sbencoder.h"
+#include "sbmetrics.h"
+#include "sbsched.h"
+#include "sbtrace.h"
 
+#include <atomic>
+#include <cerrno>
 #include <cstring>
 #include <mutex>
+#include <poll.h>
+#include <sys/socket.h>
 #include <unistd.h>
+#include <vector>
 
 #define SBSTREAMER_ICON "/pulseaudio.png"
-#define SBSTREAMER_CONTENT "audio/flac"
 #define SBSTREAMER_DESC "Audio stream from %s"
 #define SBSTREAMER_TIMEOUT 10000
 #define SBSTREAMER_MAX_PLAYBACK 3
-#define SBSTREAMER_CHUNK 16384
 
 using namespace NSROOT;
 
@@ -51,14 +59,14 @@ void encode_squeezebox_audio(const char* data, int len)
         if (g_enc) {
             int written = ((SBEncoder*)g_enc)->write(data, len, SBSTREAMER_TIMEOUT);
             if (written != len) {
-                printf("encode_squeezebox_audio: write() failed %d != %d\n", written, len);
+                sbtrace(SBT_AUDIO_WRITE_FAILED, ((SBEncoder*)g_enc)->streamId(), written, len);
             }
             g_enc_mutex.unlock();
             return;
         } else {
             g_enc_mutex.unlock();
             if (count++ > 100) { // 10s
-                printf("encode_squeezebox_audio: timeout waiting for stream request\n");
+                sbtrace(SBT_AUDIO_NO_STREAM, 0, 0, 0);
                 return;
             }
             usleep(100000); // 100 ms
@@ -67,6 +75,14 @@ void encode_squeezebox_audio(const char* data, int len)
     }
 }
 
+// Encoded audio of the current stream that Sonos has not played yet, 0 when there is none. Called
+// with squeezelite's output buffer locked, which is always taken before the encoder.
+int32_t squeezebox_lead_ms()
+{
+    std::lock_guard<std::mutex> lock(g_enc_mutex);
+    return g_enc ? ((SBEncoder*)g_enc)->aheadMs() : 0;
+}
+
 void close_squeezebox_audio()
 {
     g_enc_mutex.lock();
@@ -77,6 +93,80 @@ void close_squeezebox_audio()
 }
 } // extern "C"
 
+namespace {
+// Set while the stream is handed over to another process, see SBStreamer::detach()
+std::atomic<bool> g_detaching(false);
+std::atomic<SBEncoder*> g_parked(nullptr);
+
+bool sendAll(int fd, const char* data, int len)
+{
+    while (len > 0) {
+        ssize_t r = ::send(fd, data, len, MSG_NOSIGNAL);
+        if (r > 0) {
+            data += r;
+            len -= (int)r;
+        } else if (r < 0 && errno == EINTR) {
+            continue;
+        } else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // the connection may still have the flags or timeouts set by noson
+            struct pollfd p = { fd, POLLOUT, 0 };
+            if (poll(&p, 1, SBSTREAMER_TIMEOUT) <= 0) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sends the encoded audio as HTTP chunks until the stream ends or reply() fails. A stream being
+// handed over is left without its last chunk: the connection is the next process's from then on.
+template <typename Reply>
+void sendChunks(SBEncoder* enc, int stream, uint64_t requested_us, uint64_t parked_us, Reply reply)
+{
+    // kept per HTTP worker thread, so a new stream does not allocate it again
+    static thread_local std::vector<char> chunkBuffer;
+    int chunk = sbbudget_get()->http_chunk;
+    chunkBuffer.resize(chunk + 16);
+    char* buf = chunkBuffer.data();
+    int r = 0;
+    bool first = true;
+    while ((r = enc->read(buf + 7, chunk, SBSTREAMER_TIMEOUT)) > 0) {
+        char str[8];
+        snprintf(str, sizeof(str), "%05x\r\n", (unsigned)r & 0xfffff);
+        memcpy(buf, str, 7);
+        memcpy(buf + r + 7, "\r\n", 2);
+        uint64_t t_reply = sbtrace_begin();
+        uint64_t send_us = sbtrace_now_us();
+        if (!reply(buf, r + 7 + 2)) {
+            break;
+        }
+        uint64_t sent_us = sbtrace_now_us();
+        sbmetrics_add(SBM_HTTP_SEND_BLOCKED_US, sent_us - send_us);
+        sbmetrics_add(SBM_HTTP_SENT_BYTES, r + 7 + 2);
+        if (first) {
+            first = false;
+            if (requested_us) {
+                sbmetrics_ttfb((sent_us - requested_us) / 1000);
+                sbmetrics_start_phase(SBP_FIRST_BYTE, stream);
+            }
+            if (parked_us) {
+                sbmetrics_set(SBM_HANDOVER_GAP_MS, (sent_us - parked_us) / 1000);
+            }
+        }
+        sbtrace_end(SBS_REPLY, stream, t_reply, r);
+    }
+    if (g_detaching) {
+        g_parked = enc;
+        for (;;) {
+            sleep(60); // until the process exits
+        }
+    }
+    reply("0\r\n\r\n", 5);
+}
+}
+
 SBStreamer::SBStreamer(RequestBroker* imageService /*= nullptr*/)
     : RequestBroker()
     , m_resources()
@@ -88,10 +178,10 @@ SBStreamer::SBStreamer(RequestBroker* imageService /*= nullptr*/)
             SBSTREAMER_ICON, DataReader::Instance());
     }
     ResourcePtr ptr = ResourcePtr(new Resource());
-    ptr->uri = SBSTREAMER_URI;
+    ptr->uri = std::string(SBSTREAMER_URI) + SBCodec::name();
     ptr->title = SBSTREAMER_CNAME;
     ptr->description = SBSTREAMER_DESC;
-    ptr->contentType = SBSTREAMER_CONTENT;
+    ptr->contentType = SBCodec::contentType();
     if (img) {
         ptr->iconUri.assign(img->uri).append("?id=" LIBVERSION);
     }
@@ -102,7 +192,8 @@ bool SBStreamer::HandleRequest(handle* handle)
 {
     if (!IsAborted()) {
         const std::string& requrl = RequestBroker::GetRequestURI(handle);
-        if (requrl.compare(0, strlen(SBSTREAMER_URI), SBSTREAMER_URI) == 0) {
+        const std::string& uri = m_resources.front()->uri;
+        if (requrl.compare(0, uri.length(), uri) == 0) {
             switch (RequestBroker::GetRequestMethod(handle)) {
             case RequestBroker::Method_GET: {
                 std::vector<std::string> params;
@@ -114,8 +205,9 @@ bool SBStreamer::HandleRequest(handle* handle)
             case RequestBroker::Method_HEAD: {
                 std::string resp;
                 resp.assign(RequestBroker::MakeResponseHeader(RequestBroker::Status_OK))
-                    .append("Content-Type: audio/flac\r\n")
-                    .append("\r\n");
+                    .append("Content-Type: ")
+                    .append(SBCodec::contentType())
+                    .append("\r\n\r\n");
                 RequestBroker::Reply(handle, resp.c_str(), resp.length());
                 return true;
             }
@@ -160,17 +252,23 @@ void SBStreamer::UnregisterResource(const std::string& uri)
 
 void SBStreamer::streamSqueezeBox(handle* handle, int stream)
 {
-    printf("Sonos requested stream %d\n", stream);
+    uint64_t t = sbtrace_begin();
+    uint64_t requested_us = sbtrace_now_us();
+    sbtrace(SBT_HTTP_REQUEST, stream, stream, 0);
+    sbmetrics_start_phase(SBP_HTTP_GET, stream);
+    sbsched_apply(SBR_HTTP); // the noson worker keeps these settings for later requests
 
     m_playbackCount.Add(1);
 
     if (m_playbackCount.Load() > SBSTREAMER_MAX_PLAYBACK) {
-        printf("ERROR: overloaded http (load=%d)\n", m_playbackCount.Load());
+        sbtrace(SBT_HTTP_OVERLOAD, stream, m_playbackCount.Load(), 0);
         Reply429(handle);
     } else {
         std::string resp;
         resp.assign(RequestBroker::MakeResponseHeader(RequestBroker::Status_OK))
-            .append("Content-Type: audio/flac\r\n")
+            .append("Content-Type: ")
+            .append(SBCodec::contentType())
+            .append("\r\n")
             .append("Transfer-Encoding: chunked\r\n")
             .append("\r\n");
 
@@ -182,7 +280,7 @@ void SBStreamer::streamSqueezeBox(handle* handle, int stream)
                 if (g_enc) {
                     if (((SBEncoder*)g_enc)->streamId() == stream) {
                         g_enc_mutex.unlock();
-                        printf("Sonos requested stream that is already playing -- rejecting this request\n");
+                        sbtrace(SBT_HTTP_DUPLICATE, stream, 0, 0);
                         Reply429(handle);
                         m_playbackCount.Sub(1);
                         return;
@@ -193,18 +291,9 @@ void SBStreamer::streamSqueezeBox(handle* handle, int stream)
                 g_enc = enc;
                 g_enc_mutex.unlock();
             }
-            char* buf = new char[SBSTREAMER_CHUNK + 16];
-            int r = 0;
-            while (!IsAborted() && (r = enc->read(buf + 7, SBSTREAMER_CHUNK, SBSTREAMER_TIMEOUT)) > 0) {
-                char str[8];
-                snprintf(str, sizeof(str), "%05x\r\n", (unsigned)r & 0xfffff);
-                memcpy(buf, str, 7);
-                memcpy(buf + r + 7, "\r\n", 2);
-                if (!RequestBroker::Reply(handle, buf, r + 7 + 2)) {
-                    break;
-                }
-            }
-            RequestBroker::Reply(handle, "0\r\n\r\n", 5);
+            sendChunks(enc, stream, requested_us, 0, [this, handle](const char* data, int len) {
+                return !IsAborted() && RequestBroker::Reply(handle, data, len);
+            });
             {
                 g_enc_mutex.lock();
                 enc->close();
@@ -214,13 +303,58 @@ void SBStreamer::streamSqueezeBox(handle* handle, int stream)
                 g_enc_mutex.unlock();
             }
             delete enc;
-            delete[] buf;
         }
     }
 
     m_playbackCount.Sub(1);
 
-    printf("Done serving stream %d to Sonos\n", stream);
+    sbtrace(SBT_HTTP_DONE, stream, stream, 0);
+    sbtrace_end(SBS_HTTP_STREAM, stream, t, 0);
+}
+
+bool SBStreamer::detach(SBEncoderState& state)
+{
+    g_enc_mutex.lock(); // not unlocked: squeezelite writes no more audio into this process's streams
+    SBEncoder* enc = (SBEncoder*)g_enc;
+    if (!enc) {
+        return false;
+    }
+    g_detaching = true;
+    enc->interrupt();
+    for (int i = 0; i < SBSTREAMER_TIMEOUT && g_parked != enc; ++i) {
+        usleep(1000); // 1 ms
+    }
+    return g_parked == enc && enc->detach(state);
+}
+
+void SBStreamer::resume(int fd, SBEncoder* enc, uint64_t parked_us)
+{
+    int stream = enc->streamId();
+    uint64_t t = sbtrace_begin();
+    sbsched_apply(SBR_HTTP);
+    {
+        g_enc_mutex.lock();
+        if (g_enc) {
+            ((SBEncoder*)g_enc)->close();
+        }
+        g_enc = enc;
+        g_enc_mutex.unlock();
+    }
+    sendChunks(enc, stream, 0, parked_us, [fd](const char* data, int len) {
+        return sendAll(fd, data, len);
+    });
+    {
+        g_enc_mutex.lock();
+        enc->close();
+        if (g_enc == enc) {
+            g_enc = 0;
+        }
+        g_enc_mutex.unlock();
+    }
+    ::close(fd);
+    delete enc;
+    sbtrace(SBT_HTTP_DONE, stream, stream, 0);
+    sbtrace_end(SBS_HTTP_STREAM, stream, t, 0);
 }
 
 void SBStreamer::Reply400(handle* handle)
@@ -232,6 +366,7 @@ void SBStreamer::Reply400(handle* handle)
 
 void SBStreamer::Reply429(handle* handle)
 {
+    sbmetrics_add(SBM_HTTP_REJECTED, 1);
     std::string resp;
     resp.append(RequestBroker::MakeResponseHeader(RequestBroker::Status_Too_Many_Requests)).append("\r\n");
     RequestBroker::Reply(handle, resp.c_str(), resp.length());
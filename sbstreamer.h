@@ -22,11 +22,12 @@
 
 #include "locked.h"
 #include "requestbroker.h"
+#include "sbencoder.h"
 
 #include <vector>
 
 #define SBSTREAMER_CNAME "squeezebox"
-#define SBSTREAMER_URI "/music/squeezebox.flac"
+#define SBSTREAMER_URI "/music/squeezebox." // followed by the codec name
 
 namespace NSROOT {
 
@@ -42,6 +43,13 @@ public:
     RequestBroker::ResourcePtr RegisterResource(const std::string& title, const std::string& description, const std::string& path, StreamReader* delegate) override;
     void UnregisterResource(const std::string& uri) override;
 
+    // Hand-over of the current stream to another process (see sbhandover.h). detach() stops it
+    // between two chunks and takes out the encoder state; from then on the HTTP worker does not
+    // touch the connection and squeezelite audio is no longer accepted. resume() serves the
+    // stream on the connection passed on, until it ends, and takes ownership of fd and enc.
+    static bool detach(SBEncoderState& state);
+    static void resume(int fd, SBEncoder* enc, uint64_t parked_us);
+
 private:
     ResourceList m_resources;
     LockedNumber<int> m_playbackCount;
@@ -0,0 +1,450 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "sbtrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <set>
+#include <signal.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define SBTRACE_RING_SIZE 1024 // events per thread, power of two
+#define SBTRACE_HISTORY 512 // events kept for sbtrace_dump()
+#define SBTRACE_DRAIN_US 10000 // 10 ms
+#define SBTRACE_RATE 10 // lines per second per event type
+#define SBTRACE_BURST 20
+#define SBTRACE_DUMP_QUIET_US 10000000 // errors closer together than 10 s share one history dump
+#define SBTRACE_SPANS_MAX 262144 // spans and counter samples kept for the trace file
+
+namespace {
+
+typedef enum {
+    INFO,
+    WARN,
+    ERROR
+} Level_t;
+
+struct EventType {
+    const char* name;
+    Level_t level;
+    const char* format;
+};
+
+const EventType g_types[SBT_COUNT] = {
+#define SBTRACE_TYPE(name, level, format) { #name, level, format },
+    SBTRACE_EVENTS(SBTRACE_TYPE)
+#undef SBTRACE_TYPE
+};
+
+const char* g_span_names[SBS_COUNT] = {
+#define SBTRACE_NAME(name, label) label,
+    SBTRACE_SPANS(SBTRACE_NAME)
+#undef SBTRACE_NAME
+};
+
+const char* g_counter_names[SBC_COUNT] = {
+#define SBTRACE_NAME(name, label) label,
+    SBTRACE_COUNTERS(SBTRACE_NAME)
+#undef SBTRACE_NAME
+};
+
+typedef enum {
+    LOG,
+    SPAN, // ts_us = begin, a = duration, b = argument
+    COUNTER // a = value
+} Kind_t;
+
+struct Event {
+    uint64_t ts_us;
+    int64_t a;
+    int64_t b;
+    uint32_t stream;
+    uint8_t id;
+    uint8_t kind;
+    uint16_t thread;
+};
+
+// single producer (the owning thread), single consumer (the drain thread)
+struct Ring {
+    std::atomic<uint32_t> head { 0 };
+    std::atomic<uint32_t> tail { 0 };
+    std::atomic<uint32_t> dropped { 0 };
+    std::atomic<bool> owned { false };
+    uint16_t thread = 0;
+    Event events[SBTRACE_RING_SIZE];
+
+    void push(const Event& ev)
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= SBTRACE_RING_SIZE) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        events[h & (SBTRACE_RING_SIZE - 1)] = ev;
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    bool pop(Event& ev)
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        ev = events[t & (SBTRACE_RING_SIZE - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+std::mutex g_rings_mutex; // only taken when a thread logs its first event, and by the drain thread
+std::vector<Ring*> g_rings;
+
+// releases the ring of an exiting thread so it can be reused by a new one
+struct RingOwner {
+    Ring* ring = nullptr;
+    ~RingOwner()
+    {
+        if (ring) {
+            ring->owned.store(false, std::memory_order_release);
+        }
+    }
+};
+
+thread_local RingOwner t_owner;
+
+Ring* threadRing()
+{
+    if (t_owner.ring) {
+        return t_owner.ring;
+    }
+    std::lock_guard<std::mutex> lock(g_rings_mutex);
+    Ring* ring = nullptr;
+    for (Ring* r : g_rings) {
+        bool expected = false;
+        if (r->owned.compare_exchange_strong(expected, true)) {
+            ring = r;
+            break;
+        }
+    }
+    if (!ring) {
+        ring = new Ring();
+        ring->owned.store(true);
+        ring->thread = (uint16_t)g_rings.size();
+        g_rings.push_back(ring);
+    }
+    t_owner.ring = ring;
+    return ring;
+}
+
+struct Limiter {
+    uint64_t last_us = 0;
+    double tokens = SBTRACE_BURST;
+    unsigned suppressed = 0;
+};
+
+std::atomic<bool> g_running(false);
+bool g_dump_on_error = false;
+uint64_t g_dump_quiet_until_us = 0; // no dump for errors before this
+std::thread* g_drain = nullptr;
+std::mutex g_drain_mutex; // serializes drain() between the drain thread, sbtrace_dump() and exit
+Limiter g_limiters[SBT_COUNT];
+Event g_history[SBTRACE_HISTORY];
+unsigned g_history_len = 0;
+unsigned g_history_pos = 0;
+uint64_t g_start_us = 0;
+
+std::atomic<bool> g_spans_enabled(false);
+std::atomic<bool> g_spans_write(false);
+std::string g_spans_file;
+std::vector<Event> g_spans; // circular once SBTRACE_SPANS_MAX is reached
+size_t g_spans_pos = 0;
+
+void printEvent(const Event& ev, const char* prefix)
+{
+    const EventType& type = g_types[ev.id];
+    uint64_t rel = ev.ts_us - g_start_us;
+    printf("%s%5u.%03u [%u] ", prefix, (unsigned)(rel / 1000000), (unsigned)(rel / 1000 % 1000), ev.stream);
+    printf(type.format, (long long)ev.a, (long long)ev.b);
+    printf("\n");
+}
+
+void dumpHistory()
+{
+    printf("---- trace history (%u events) ----\n", g_history_len);
+    unsigned first = (g_history_pos + SBTRACE_HISTORY - g_history_len) % SBTRACE_HISTORY;
+    for (unsigned i = 0; i < g_history_len; ++i) {
+        const Event& ev = g_history[(first + i) % SBTRACE_HISTORY];
+        printf("%-24s t%-3u ", g_types[ev.id].name, ev.thread);
+        printEvent(ev, "");
+    }
+    printf("---- end of trace history ----\n");
+}
+
+bool allowed(const Event& ev)
+{
+    Limiter& l = g_limiters[ev.id];
+    if (l.last_us) {
+        l.tokens += (double)(ev.ts_us - l.last_us) * SBTRACE_RATE / 1000000.0;
+        if (l.tokens > SBTRACE_BURST) {
+            l.tokens = SBTRACE_BURST;
+        }
+    }
+    l.last_us = ev.ts_us;
+    if (l.tokens < 1.0) {
+        ++l.suppressed;
+        return false;
+    }
+    l.tokens -= 1.0;
+    if (l.suppressed) {
+        printf("(%u similar %s messages suppressed)\n", l.suppressed, g_types[ev.id].name);
+        l.suppressed = 0;
+    }
+    return true;
+}
+
+void storeSpan(const Event& ev)
+{
+    if (g_spans.size() < SBTRACE_SPANS_MAX) {
+        g_spans.push_back(ev);
+    } else {
+        g_spans[g_spans_pos] = ev;
+        g_spans_pos = (g_spans_pos + 1) % SBTRACE_SPANS_MAX;
+    }
+}
+
+void writeSpans()
+{
+    std::string tmp = g_spans_file + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (!f) {
+        printf("sbtrace: unable to write %s\n", tmp.c_str());
+        return;
+    }
+    std::set<uint32_t> streams;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < g_spans.size(); ++i) {
+        const Event& ev = g_spans[(g_spans_pos + i) % g_spans.size()];
+        streams.insert(ev.stream);
+        if (ev.kind == SPAN) {
+            fprintf(f, "{\"name\":\"%s\",\"cat\":\"audio\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%lld,\"pid\":%u,\"tid\":%u,\"args\":{\"stream\":%u,\"arg\":%lld}},\n",
+                g_span_names[ev.id], (unsigned long long)(ev.ts_us - g_start_us), (long long)ev.a, ev.stream, ev.thread, ev.stream, (long long)ev.b);
+        } else {
+            fprintf(f, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%llu,\"pid\":%u,\"args\":{\"bytes\":%lld}},\n",
+                g_counter_names[ev.id], (unsigned long long)(ev.ts_us - g_start_us), ev.stream, (long long)ev.a);
+        }
+    }
+    for (uint32_t stream : streams) {
+        fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"stream %u\"}},\n", stream, stream);
+    }
+    fprintf(f, "{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":0,\"args\":{\"sort_index\":0}}\n]}\n");
+    fclose(f);
+    if (rename(tmp.c_str(), g_spans_file.c_str()) == 0) {
+        printf("sbtrace: wrote %zu trace events to %s\n", g_spans.size(), g_spans_file.c_str());
+    }
+}
+
+void sigusr1(int signum)
+{
+    (void)signum;
+    g_spans_write.store(true);
+}
+
+void drain()
+{
+    std::vector<Event> batch;
+    {
+        std::lock_guard<std::mutex> lock(g_rings_mutex);
+        for (Ring* r : g_rings) {
+            Event ev;
+            while (r->pop(ev)) {
+                batch.push_back(ev);
+            }
+            uint32_t dropped = r->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped) {
+                printf("(trace ring of thread t%u overflowed, %u events lost)\n", r->thread, dropped);
+            }
+        }
+    }
+    std::stable_sort(batch.begin(), batch.end(), [](const Event& x, const Event& y) { return x.ts_us < y.ts_us; });
+    for (const Event& ev : batch) {
+        if (ev.kind != LOG) {
+            storeSpan(ev);
+            continue;
+        }
+        g_history[g_history_pos] = ev;
+        g_history_pos = (g_history_pos + 1) % SBTRACE_HISTORY;
+        if (g_history_len < SBTRACE_HISTORY) {
+            ++g_history_len;
+        }
+        if (allowed(ev)) {
+            printEvent(ev, "");
+        }
+        if (g_dump_on_error && g_types[ev.id].level == ERROR) {
+            if (ev.ts_us >= g_dump_quiet_until_us) {
+                dumpHistory();
+            }
+            g_dump_quiet_until_us = ev.ts_us + SBTRACE_DUMP_QUIET_US;
+        }
+    }
+    if (g_spans_write.exchange(false) && g_spans_enabled.load()) {
+        writeSpans();
+    }
+    if (!batch.empty()) {
+        fflush(stdout);
+    }
+}
+
+void drainThread()
+{
+    while (g_running.load()) {
+        usleep(SBTRACE_DRAIN_US);
+        std::lock_guard<std::mutex> lock(g_drain_mutex);
+        drain();
+    }
+}
+
+void drainAtExit()
+{
+    std::lock_guard<std::mutex> lock(g_drain_mutex);
+    g_spans_write.store(true);
+    drain();
+}
+
+void push(const Event& event)
+{
+    Event ev = event;
+    Ring* ring = threadRing();
+    ev.thread = ring->thread;
+    ring->push(ev);
+}
+
+} // namespace
+
+extern "C" {
+
+uint64_t sbtrace_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void sbtrace_init(int dump_on_error)
+{
+    if (g_running.exchange(true)) {
+        return;
+    }
+    g_dump_on_error = dump_on_error;
+    g_start_us = sbtrace_now_us();
+    g_drain = new std::thread(drainThread);
+    // stops the drain thread before the final drain, the rings have a single consumer
+    atexit(sbtrace_close);
+}
+
+void sbtrace_close(void)
+{
+    if (!g_running.exchange(false)) {
+        return;
+    }
+    g_drain->join();
+    delete g_drain;
+    g_drain = nullptr;
+    drainAtExit();
+}
+
+void sbtrace(sbtrace_id id, unsigned stream, int64_t a, int64_t b)
+{
+    Event ev;
+    ev.ts_us = sbtrace_now_us();
+    ev.a = a;
+    ev.b = b;
+    ev.stream = stream;
+    ev.id = (uint8_t)id;
+    ev.kind = LOG;
+    push(ev);
+}
+
+void sbtrace_spans(const char* filename)
+{
+    g_spans_file = filename;
+    g_spans.reserve(SBTRACE_SPANS_MAX);
+    signal(SIGUSR1, sigusr1);
+    g_spans_enabled.store(true);
+}
+
+void sbtrace_write_spans(void)
+{
+    g_spans_write.store(true);
+}
+
+uint64_t sbtrace_begin(void)
+{
+    if (!g_spans_enabled.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+    return sbtrace_now_us();
+}
+
+void sbtrace_end(sbtrace_span span, unsigned stream, uint64_t begin_us, int64_t arg)
+{
+    if (!begin_us) {
+        return;
+    }
+    Event ev;
+    ev.ts_us = begin_us;
+    ev.a = (int64_t)(sbtrace_now_us() - begin_us);
+    ev.b = arg;
+    ev.stream = stream;
+    ev.id = (uint8_t)span;
+    ev.kind = SPAN;
+    push(ev);
+}
+
+void sbtrace_count(sbtrace_counter counter, unsigned stream, int64_t value)
+{
+    if (!g_spans_enabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    Event ev;
+    ev.ts_us = sbtrace_now_us();
+    ev.a = value;
+    ev.b = 0;
+    ev.stream = stream;
+    ev.id = (uint8_t)counter;
+    ev.kind = COUNTER;
+    push(ev);
+}
+
+void sbtrace_dump(void)
+{
+    std::lock_guard<std::mutex> lock(g_drain_mutex);
+    drain();
+    dumpHistory();
+    fflush(stdout);
+}
+
+} // extern "C"
@@ -0,0 +1,129 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SBTRACE_H
+#define SBTRACE_H
+
+// Tracing for the audio path. Events are small binary records that are pushed into a lock-free
+// ring owned by the calling thread. A background thread drains the rings, prints the events as
+// text (rate-limited per event type) and keeps a history that can be dumped when an error occurs;
+// errors that follow each other within a few seconds share one dump.
+//
+// Every message is formatted with two 64-bit arguments (a, b); the stream id is shown in front.
+
+#include <stdint.h>
+
+#define SBTRACE_EVENTS(X)                                                                                   \
+    X(STREAM_NEW, INFO, "Creating new stream (%lld) for Sonos")                                             \
+    X(SILENT_TO_AUDIO, INFO, "From silent to non-silent")                                                   \
+    X(AUDIO_TO_SILENT, INFO, "From non-silent to silent")                                                   \
+    X(ENC_OPEN_TWICE, WARN, "SBEncoder::open -- already opened")                                            \
+    X(ENC_OPEN_FAILED, ERROR, "SBEncoder::open -- encoder error %lld")                                      \
+    X(ENC_READ_CLOSED, INFO, "SBEncoder::read: encoder is closed")                                          \
+    X(ENC_READ_MISMATCH, WARN, "SBEncoder::read: stream mismatch (%lld != %lld)")                           \
+    X(ENC_READ_DRAINED, INFO, "All data consumed")                                                          \
+    X(ENC_READ_TIMEOUT, ERROR, "SBEncoder::read: timeout")                                                  \
+    X(ENC_WRITE_INACTIVE, WARN, "SBEncoder::write: encoder not active")                                     \
+    X(ENC_WRITE_MISMATCH, WARN, "SBEncoder::write: stream mismatch (%lld != %lld)")                         \
+    X(ENC_WRITE_EOS, INFO, "Reached end of stream")                                                         \
+    X(ENC_WRITE_TIMEOUT, ERROR, "SBEncoder::write: timeout")                                                \
+    X(ENC_RING_FULL, WARN, "SBEncoder: stream queue full, dropped a frame of %lld bytes (%lld queued)")     \
+    X(ENC_CODEC_FAILED, ERROR, "SBEncoder::encode -- codec error, ending the stream")                       \
+    X(AUDIO_WRITE_FAILED, ERROR, "encode_squeezebox_audio: write() failed %lld != %lld")                    \
+    X(AUDIO_NO_STREAM, ERROR, "encode_squeezebox_audio: timeout waiting for stream request")                \
+    X(HTTP_REQUEST, INFO, "Sonos requested stream %lld")                                                    \
+    X(HTTP_OVERLOAD, ERROR, "ERROR: overloaded http (load=%lld)")                                           \
+    X(HTTP_DUPLICATE, WARN, "Sonos requested stream that is already playing -- rejecting this request")     \
+    X(HTTP_DONE, INFO, "Done serving stream %lld to Sonos")                                                 \
+    X(STREAM_STARTED, INFO, "Stream start: first byte after %lld ms, PlayStream took %lld ms")              \
+    X(STREAM_STALLED, WARN, "Stream stalled: Sonos pulled %lld bytes where %lld were expected, restarting") \
+    X(STREAM_RECOVERED, INFO, "Stream recovered %lld ms after the stall began")                             \
+    X(FLUSH, INFO, "Flushed by skip, seek or stop with %lld ms queued, new stream: %lld")                   \
+    X(SKIP_DONE, INFO, "New audio queued %lld ms after the flush")                                          \
+    X(VOLUME_FAILED, WARN, "Unable to set the Sonos volume to %lld")                                        \
+    X(SOAP_FAILED, WARN, "UPnP control request failed (%lld in the batch)")                                 \
+    X(SOAP_CONNECT_FAILED, WARN, "Unable to connect to Sonos port %lld for UPnP control")                   \
+    X(SOAP_BUSY, WARN, "No UPnP control connection free in time (%lld busy, %lld open)")                    \
+    X(HANDOVER, INFO, "Stream handed over with %lld bytes (%lld ms) queued")                                \
+    X(TAKEOVER, INFO, "Stream taken over with %lld bytes (%lld ms) queued")
+
+typedef enum {
+#define SBTRACE_ENUM(name, level, format) SBT_##name,
+    SBTRACE_EVENTS(SBTRACE_ENUM)
+#undef SBTRACE_ENUM
+        SBT_COUNT
+} sbtrace_id;
+
+// Pipeline stages recorded as spans (and counters) when a trace file is configured. The trace is
+// written in Chrome trace-event format (load it in chrome://tracing or ui.perfetto.dev), with one
+// process track per stream id.
+#define SBTRACE_SPANS(X)               \
+    X(OUTPUT_FRAMES, "_output_frames") \
+    X(THROTTLE, "throttle")            \
+    X(ENCODE, "SBEncoder::encode")     \
+    X(FLAC_WRITE, "write_callback")    \
+    X(QUEUE, "SBRing::write")          \
+    X(DEQUEUE, "SBRing::read")         \
+    X(ENCODER_READ, "SBEncoder::read") \
+    X(REPLY, "RequestBroker::Reply")   \
+    X(HTTP_STREAM, "streamSqueezeBox") \
+    X(PLAYSTREAM, "PlayStream")        \
+    X(SET_VOLUME, "SetVolume")         \
+    X(SOAP, "SOAP")
+
+#define SBTRACE_COUNTERS(X)   \
+    X(STREAMBUF, "streambuf") \
+    X(OUTPUTBUF, "outputbuf") \
+    X(FRAMEBUFFER, "SBRing")
+
+typedef enum {
+#define SBTRACE_ENUM(name, label) SBS_##name,
+    SBTRACE_SPANS(SBTRACE_ENUM)
+#undef SBTRACE_ENUM
+        SBS_COUNT
+} sbtrace_span;
+
+typedef enum {
+#define SBTRACE_ENUM(name, label) SBC_##name,
+    SBTRACE_COUNTERS(SBTRACE_ENUM)
+#undef SBTRACE_ENUM
+        SBC_COUNT
+} sbtrace_counter;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sbtrace_init(int dump_on_error);
+void sbtrace_close(void);
+void sbtrace(sbtrace_id id, unsigned stream, int64_t a, int64_t b);
+void sbtrace_dump(void);
+uint64_t sbtrace_now_us(void);
+
+void sbtrace_spans(const char* filename);
+void sbtrace_write_spans(void);
+uint64_t sbtrace_begin(void); // 0 when no trace file is configured
+void sbtrace_end(sbtrace_span span, unsigned stream, uint64_t begin_us, int64_t arg);
+void sbtrace_count(sbtrace_counter counter, unsigned stream, int64_t value);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* SBTRACE_H */
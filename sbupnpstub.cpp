@@ -0,0 +1,518 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "sbupnpstub.h"
+
+#include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define UPNP_SERVER "Linux UPnP/1.0 Sonos/70.3-35220 (ZPS1)"
+#define UPNP_TIMEOUT_S 3600
+#define UPNP_VOLUME 20
+
+static uint64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string xmlEscape(const std::string& str)
+{
+    std::string out;
+    for (char c : str) {
+        switch (c) {
+        case '&':
+            out.append("&amp;");
+            break;
+        case '<':
+            out.append("&lt;");
+            break;
+        case '>':
+            out.append("&gt;");
+            break;
+        case '"':
+            out.append("&quot;");
+            break;
+        default:
+            out.push_back(c);
+        }
+    }
+    return out;
+}
+
+static std::string xmlUnescape(std::string str)
+{
+    static const char* entities[][2] = { { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" }, { "&apos;", "'" }, { "&amp;", "&" } };
+    for (auto& e : entities) {
+        size_t pos;
+        while ((pos = str.find(e[0])) != std::string::npos) {
+            str.replace(pos, strlen(e[0]), e[1]);
+        }
+    }
+    return str;
+}
+
+static std::string xmlValue(const std::string& xml, const std::string& tag)
+{
+    size_t begin = xml.find("<" + tag + ">");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    begin += tag.length() + 2;
+    size_t end = xml.find("</" + tag + ">", begin);
+    return xmlUnescape(xml.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+}
+
+static std::string header(const std::string& headers, const char* name)
+{
+    size_t len = strlen(name);
+    size_t pos = 0;
+    while ((pos = headers.find("\r\n", pos)) != std::string::npos) {
+        pos += 2;
+        if (strncasecmp(headers.c_str() + pos, name, len) == 0 && headers[pos + len] == ':') {
+            size_t begin = headers.find_first_not_of(' ', pos + len + 1);
+            return headers.substr(begin, headers.find("\r\n", begin) - begin);
+        }
+    }
+    return "";
+}
+
+static bool sendAll(int fd, const std::string& data)
+{
+    const char* p = data.data();
+    size_t len = data.length();
+    while (len) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void reply(int fd, const char* status, const std::string& extra, const std::string& body, bool keepAlive = false)
+{
+    sendAll(fd, std::string("HTTP/1.1 ") + status + "\r\nServer: " UPNP_SERVER "\r\n" + extra
+            + "Content-Length: " + std::to_string(body.length()) + (keepAlive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n") + body);
+}
+
+SonosUPnPStub::SonosUPnPStub(unsigned port, const std::string& roomName, const SimOptions& options)
+    : m_port(port)
+    , m_room(roomName)
+    , m_host("127.0.0.1")
+    , m_options(options)
+    , m_listen(-1)
+    , m_running(false)
+    , m_thread(nullptr)
+    , m_nextSid(1)
+    , m_state("STOPPED")
+    , m_playUs(0)
+    , m_client(nullptr)
+    , m_clientThread(nullptr)
+    , m_streams(0)
+{
+    char uuid[32];
+    snprintf(uuid, sizeof(uuid), "RINCON_0253494D%04X01400", port & 0xffff); // MAC 02:53:49:4D:xx:xx
+    m_uuid = uuid;
+}
+
+SonosUPnPStub::~SonosUPnPStub()
+{
+    stop();
+}
+
+bool SonosUPnPStub::start()
+{
+    m_listen = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(m_port);
+    if (bind(m_listen, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(m_listen, 16) != 0) {
+        printf("upnp: unable to listen on port %u\n", m_port);
+        close(m_listen);
+        m_listen = -1;
+        return false;
+    }
+    m_running = true;
+    m_thread = new std::thread(&SonosUPnPStub::listenThread, this);
+    printf("upnp: player %s (%s) listening on port %u\n", m_room.c_str(), m_uuid.c_str(), m_port);
+    return true;
+}
+
+void SonosUPnPStub::stop()
+{
+    if (!m_running) {
+        return;
+    }
+    m_running = false;
+    shutdown(m_listen, SHUT_RDWR);
+    m_thread->join();
+    delete m_thread;
+    m_thread = nullptr;
+    close(m_listen);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stopStream();
+}
+
+void SonosUPnPStub::listenThread()
+{
+    while (m_running) {
+        int fd = accept(m_listen, 0, 0);
+        if (fd >= 0) {
+            std::thread(&SonosUPnPStub::serve, this, fd).detach();
+        }
+    }
+}
+
+// SOAP requests on HTTP/1.1 keep the connection open, also when pipelined; anything else is
+// answered and closed.
+void SonosUPnPStub::serve(int fd)
+{
+    std::string req;
+    char buf[4096];
+    unsigned requests = 0;
+    for (bool keepAlive = true; keepAlive;) {
+        size_t end;
+        while ((end = req.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                if (requests > 1) {
+                    printf("upnp: %u requests on one connection\n", requests);
+                }
+                close(fd);
+                return;
+            }
+            req.append(buf, n);
+        }
+        std::string headers = req.substr(0, end + 2);
+        size_t length = strtoul(header(headers, "Content-Length").c_str(), 0, 10);
+        while (req.length() < end + 4 + length) {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                close(fd);
+                return;
+            }
+            req.append(buf, n);
+        }
+        std::string body = req.substr(end + 4, length);
+        req.erase(0, end + 4 + length);
+        keepAlive = headers.compare(0, 4, "POST") == 0 && headers.find(" HTTP/1.1\r\n") != std::string::npos
+            && strncasecmp(header(headers, "Connection").c_str(), "close", 5) != 0;
+        ++requests;
+        serveOne(fd, headers, body, keepAlive);
+    }
+    close(fd);
+}
+
+void SonosUPnPStub::serveOne(int fd, const std::string& headers, const std::string& body, bool keepAlive)
+{
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    if (getsockname(fd, (struct sockaddr*)&local, &len) == 0) {
+        char ip[INET_ADDRSTRLEN];
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_host = inet_ntop(AF_INET, &local.sin_addr, ip, sizeof(ip));
+    }
+
+    std::string method = headers.substr(0, headers.find(' '));
+    std::string path = headers.substr(method.length() + 1, headers.find(' ', method.length() + 1) - method.length() - 1);
+    if (!handle(fd, method, path, headers, body, keepAlive)) {
+        reply(fd, "404 Not Found", "", "", keepAlive);
+    }
+}
+
+bool SonosUPnPStub::handle(int fd, const std::string& method, const std::string& path, const std::string& headers, const std::string& body, bool keepAlive)
+{
+    if (method == "GET" && path == "/xml/device_description.xml") {
+        reply(fd, "200 OK", "Content-Type: text/xml; charset=\"utf-8\"\r\n", deviceDescription());
+        return true;
+    }
+    if (method == "SUBSCRIBE") {
+        subscribe(fd, path, headers);
+        return true;
+    }
+    if (method == "UNSUBSCRIBE") {
+        std::string sid = header(headers, "SID");
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_subscriptions.begin(); it != m_subscriptions.end(); ++it) {
+            if (it->sid == sid) {
+                m_subscriptions.erase(it);
+                break;
+            }
+        }
+        reply(fd, "200 OK", "", "");
+        return true;
+    }
+    if (method == "POST") {
+        // SOAPACTION: "urn:schemas-upnp-org:service:AVTransport:1#Play"
+        std::string action = header(headers, "SOAPACTION");
+        action.erase(std::remove(action.begin(), action.end(), '"'), action.end());
+        size_t hash = action.find('#');
+        if (hash == std::string::npos) {
+            return false;
+        }
+        std::string type = action.substr(0, hash);
+        std::string name = action.substr(hash + 1);
+        size_t s = type.find(":service:");
+        std::string service = s == std::string::npos ? "" : type.substr(s + 9, type.rfind(':') - s - 9);
+        std::string out = soap(service, name, body);
+        reply(fd, "200 OK", "Content-Type: text/xml; charset=\"utf-8\"\r\n",
+            "<?xml version=\"1.0\"?><s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+            "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body><u:"
+                + name + "Response xmlns:u=\"" + type + "\">" + out + "</u:" + name + "Response></s:Body></s:Envelope>",
+            keepAlive);
+        if (name == "Play" || name == "Stop" || name == "Pause") {
+            notify("AVTransport");
+        }
+        return true;
+    }
+    return false;
+}
+
+std::string SonosUPnPStub::soap(const std::string& service, const std::string& action, const std::string& body)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    double ms = m_playUs ? (nowUs() - m_playUs) / 1000.0 : 0; // since Play
+    if (service == "ZoneGroupTopology") {
+        if (action == "GetZoneGroupState") {
+            return "<ZoneGroupState>" + xmlEscape(zoneGroupState()) + "</ZoneGroupState>";
+        }
+        if (action == "GetZoneGroupAttributes") {
+            return "<CurrentZoneGroupName>" + xmlEscape(m_room) + "</CurrentZoneGroupName><CurrentZoneGroupID>" + m_uuid
+                + ":1</CurrentZoneGroupID><CurrentZonePlayerUUIDsInGroup>" + m_uuid
+                + "</CurrentZonePlayerUUIDsInGroup><CurrentMuseHouseholdId></CurrentMuseHouseholdId>";
+        }
+    } else if (service == "AVTransport") {
+        if (action == "SetAVTransportURI") {
+            m_uri = xmlValue(body, "CurrentURI");
+            printf("upnp: SetAVTransportURI %s\n", m_uri.c_str());
+        } else if (action == "Play") {
+            printf("upnp: Play\n");
+            play();
+        } else if (action == "Stop" || action == "Pause") {
+            printf("upnp: %s\n", action.c_str());
+            stopStream();
+        } else if (action == "GetTransportInfo") {
+            return "<CurrentTransportState>" + m_state + "</CurrentTransportState><CurrentTransportStatus>OK</CurrentTransportStatus><CurrentSpeed>1</CurrentSpeed>";
+        } else if (action == "GetPositionInfo") {
+            unsigned s = m_state == "PLAYING" ? (unsigned)(ms / 1000) : 0;
+            char reltime[16];
+            snprintf(reltime, sizeof(reltime), "%u:%02u:%02u", s / 3600, s / 60 % 60, s % 60);
+            return "<Track>1</Track><TrackDuration>0:00:00</TrackDuration><TrackMetaData></TrackMetaData><TrackURI>" + xmlEscape(m_uri)
+                + "</TrackURI><RelTime>" + reltime + "</RelTime><AbsTime>NOT_IMPLEMENTED</AbsTime><RelCount>2147483647</RelCount><AbsCount>2147483647</AbsCount>";
+        } else if (action == "GetMediaInfo") {
+            return "<NrTracks>1</NrTracks><MediaDuration>NOT_IMPLEMENTED</MediaDuration><CurrentURI>" + xmlEscape(m_uri)
+                + "</CurrentURI><CurrentURIMetaData></CurrentURIMetaData><NextURI></NextURI><NextURIMetaData></NextURIMetaData>"
+                  "<PlayMedium>NETWORK</PlayMedium><RecordMedium>NOT_IMPLEMENTED</RecordMedium><WriteStatus>NOT_IMPLEMENTED</WriteStatus>";
+        }
+    } else if (service == "RenderingControl" || service == "GroupRenderingControl") {
+        if (action == "GetVolume" || action == "GetGroupVolume") {
+            return "<CurrentVolume>" + std::to_string(UPNP_VOLUME) + "</CurrentVolume>";
+        }
+        if (action == "GetMute" || action == "GetGroupMute") {
+            return "<CurrentMute>0</CurrentMute>";
+        }
+    }
+    return ""; // anything else succeeds without output arguments
+}
+
+void SonosUPnPStub::subscribe(int fd, const std::string& path, const std::string& headers)
+{
+    // /ZoneGroupTopology/Event, /MediaRenderer/AVTransport/Event, ...
+    size_t end = path.rfind('/');
+    std::string service = path.substr(path.rfind('/', end - 1) + 1, end - path.rfind('/', end - 1) - 1);
+    std::string sid = header(headers, "SID");
+    std::string callback = header(headers, "CALLBACK");
+    std::string extra = "TIMEOUT: Second-" + std::to_string(UPNP_TIMEOUT_S) + "\r\n";
+    if (!sid.empty()) {
+        reply(fd, "200 OK", "SID: " + sid + "\r\n" + extra, ""); // renewal
+        return;
+    }
+    if (callback.size() < 3) {
+        reply(fd, "412 Precondition Failed", "", "");
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Subscription sub;
+        sub.sid = "uuid:" + m_uuid + "_sub" + std::to_string(m_nextSid++);
+        sub.callback = callback.substr(1, callback.find('>') - 1);
+        sub.service = service;
+        sub.seq = 0;
+        m_subscriptions.push_back(sub);
+        sid = sub.sid;
+    }
+    reply(fd, "200 OK", "SID: " + sid + "\r\n" + extra, "");
+
+    // the initial event carries the complete state
+    std::thread([this, sid]() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (Subscription& sub : m_subscriptions) {
+            if (sub.sid == sid) {
+                notifyOne(sub);
+            }
+        }
+    }).detach();
+}
+
+void SonosUPnPStub::notify(const std::string& service)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (Subscription& sub : m_subscriptions) {
+        if (sub.service == service) {
+            notifyOne(sub);
+        }
+    }
+}
+
+void SonosUPnPStub::notifyOne(Subscription& sub)
+{
+    // callback is http://host:port/path
+    size_t host = sub.callback.find("://");
+    host = host == std::string::npos ? 0 : host + 3;
+    size_t path = sub.callback.find('/', host);
+    std::string hostPort = sub.callback.substr(host, path - host);
+    size_t colon = hostPort.find(':');
+    std::string name = hostPort.substr(0, colon);
+    std::string port = colon == std::string::npos ? "80" : hostPort.substr(colon + 1);
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(name.c_str(), port.c_str(), &hints, &res) != 0) {
+        return;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) == 0) {
+        std::string body = "<e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\"><e:property>" + propertySet(sub.service) + "</e:property></e:propertyset>";
+        sendAll(fd, "NOTIFY " + (path == std::string::npos ? "/" : sub.callback.substr(path)) + " HTTP/1.1\r\nHOST: " + hostPort
+                + "\r\nCONTENT-TYPE: text/xml; charset=\"utf-8\"\r\nNT: upnp:event\r\nNTS: upnp:propchange\r\nSID: " + sub.sid
+                + "\r\nSEQ: " + std::to_string(sub.seq++) + "\r\nContent-Length: " + std::to_string(body.length())
+                + "\r\nConnection: close\r\n\r\n" + body);
+        char buf[512];
+        recv(fd, buf, sizeof(buf), 0);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    freeaddrinfo(res);
+}
+
+std::string SonosUPnPStub::propertySet(const std::string& service)
+{
+    if (service == "ZoneGroupTopology") {
+        return "<ZoneGroupState>" + xmlEscape(zoneGroupState()) + "</ZoneGroupState>";
+    }
+    std::string event;
+    if (service == "AVTransport") {
+        event = "<Event xmlns=\"urn:schemas-upnp-org:metadata-1-0/AVT/\"><InstanceID val=\"0\"><TransportState val=\"" + m_state
+            + "\"/><CurrentPlayMode val=\"NORMAL\"/><NumberOfTracks val=\"1\"/><CurrentTrack val=\"1\"/><CurrentTrackDuration val=\"0:00:00\"/>"
+              "<CurrentTrackURI val=\""
+            + xmlEscape(m_uri) + "\"/><AVTransportURI val=\"" + xmlEscape(m_uri) + "\"/></InstanceID></Event>";
+    } else if (service == "RenderingControl") {
+        event = "<Event xmlns=\"urn:schemas-upnp-org:metadata-1-0/RCS/\"><InstanceID val=\"0\"><Volume channel=\"Master\" val=\""
+            + std::to_string(UPNP_VOLUME) + "\"/><Mute channel=\"Master\" val=\"0\"/></InstanceID></Event>";
+    }
+    return "<LastChange>" + xmlEscape(event) + "</LastChange>";
+}
+
+// called with m_mutex held
+void SonosUPnPStub::play()
+{
+    stopStream();
+    std::string url = m_uri;
+    size_t scheme = url.find("://");
+    if (scheme != std::string::npos && url.compare(0, scheme, "http") != 0) {
+        url.replace(0, scheme, "http"); // x-rincon-mp3radio:// and friends
+    }
+    m_state = "PLAYING";
+    m_playUs = nowUs();
+    unsigned n = ++m_streams;
+    SonosSimClient* client = new SonosSimClient(url, m_options);
+    m_client = client;
+    m_clientThread = new std::thread([client, n]() {
+        client->run();
+        std::string name = "stream " + std::to_string(n);
+        SonosSimClient::printHeader();
+        client->printStats(name.c_str());
+    });
+}
+
+// called with m_mutex held
+void SonosUPnPStub::stopStream()
+{
+    m_state = "STOPPED";
+    if (m_client) {
+        m_client->stop();
+        m_clientThread->join();
+        delete m_clientThread;
+        delete m_client;
+        m_client = nullptr;
+        m_clientThread = nullptr;
+    }
+}
+
+std::string SonosUPnPStub::deviceDescription() const
+{
+    std::string service;
+    auto svc = [](const char* name, const char* prefix) {
+        return std::string("<service><serviceType>urn:schemas-upnp-org:service:") + name + ":1</serviceType><serviceId>urn:upnp-org:serviceId:"
+            + name + "</serviceId><controlURL>" + prefix + "/" + name + "/Control</controlURL><eventSubURL>" + prefix + "/" + name
+            + "/Event</eventSubURL><SCPDURL>/xml/" + name + "1.xml</SCPDURL></service>";
+    };
+    return "<?xml version=\"1.0\" encoding=\"utf-8\" ?><root xmlns=\"urn:schemas-upnp-org:device-1-0\"><specVersion><major>1</major><minor>0</minor></specVersion>"
+           "<device><deviceType>urn:schemas-upnp-org:device:ZonePlayer:1</deviceType><friendlyName>127.0.0.1 - Sonos Sim</friendlyName>"
+           "<manufacturer>Sonos, Inc.</manufacturer><modelNumber>S1</modelNumber><modelName>Sonos Sim</modelName><softwareVersion>70.3-35220</softwareVersion>"
+           "<roomName>"
+        + xmlEscape(m_room) + "</roomName><displayName>Sim</displayName><UDN>uuid:" + m_uuid + "</UDN><serviceList>"
+        + svc("AlarmClock", "") + svc("DeviceProperties", "") + svc("ZoneGroupTopology", "") + "</serviceList><deviceList>"
+        + "<device><deviceType>urn:schemas-upnp-org:device:MediaServer:1</deviceType><UDN>uuid:" + m_uuid + "_MS</UDN><serviceList>"
+        + svc("ContentDirectory", "/MediaServer") + svc("ConnectionManager", "/MediaServer") + "</serviceList></device>"
+        + "<device><deviceType>urn:schemas-upnp-org:device:MediaRenderer:1</deviceType><UDN>uuid:" + m_uuid + "_MR</UDN><serviceList>"
+        + svc("RenderingControl", "/MediaRenderer") + svc("ConnectionManager", "/MediaRenderer") + svc("AVTransport", "/MediaRenderer")
+        + svc("Queue", "/MediaRenderer") + svc("GroupRenderingControl", "/MediaRenderer") + "</serviceList></device>"
+        + "</deviceList></device></root>";
+}
+
+std::string SonosUPnPStub::zoneGroupState() const
+{
+    std::string location = "http://" + m_host + ":" + std::to_string(m_port) + "/xml/device_description.xml";
+    return "<ZoneGroupState><ZoneGroups><ZoneGroup Coordinator=\"" + m_uuid + "\" ID=\"" + m_uuid + ":1\"><ZoneGroupMember UUID=\"" + m_uuid
+        + "\" Location=\"" + location + "\" ZoneName=\"" + xmlEscape(m_room)
+        + "\" Icon=\"\" Configuration=\"1\" SoftwareVersion=\"70.3-35220\" MinCompatibleVersion=\"69.0-00000\" "
+          "LegacyCompatibleVersion=\"58.0-00000\" BootSeq=\"1\" TVConfigurationError=\"0\" HdmiCecAvailable=\"0\" "
+          "WirelessMode=\"0\" WirelessLeafOnly=\"0\" ChannelFreq=\"2437\" BehindWifiExtender=\"0\" WifiEnabled=\"1\" "
+          "EthLink=\"1\" Orientation=\"0\" RoomCalibrationState=\"4\" SecureRegState=\"3\" VoiceConfigState=\"0\" "
+          "MicEnabled=\"0\" AirPlayEnabled=\"0\" IdleState=\"1\" MoreInfo=\"\"/></ZoneGroup></ZoneGroups><VanishedDevices/></ZoneGroupState>";
+}
@@ -0,0 +1,89 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SBUPNPSTUB_H
+#define SBUPNPSTUB_H
+
+#include "sbsimclient.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Stand-in for the control side of a single Sonos player: the device description, SOAP actions
+// of ZoneGroupTopology, AVTransport and RenderingControl, and GENA event subscriptions with an
+// initial NOTIFY. This is enough for SONOS::System::Discover("http://host:1400") and GetPlayer()
+// to succeed. On Play a SonosSimClient pulls the stream URI that was set with SetAVTransportURI.
+
+class SonosUPnPStub {
+public:
+    SonosUPnPStub(unsigned port, const std::string& roomName, const SimOptions& options);
+    ~SonosUPnPStub();
+
+    bool start();
+    void stop();
+
+private:
+    struct Subscription {
+        std::string sid;
+        std::string callback;
+        std::string service;
+        unsigned seq;
+    };
+
+    void listenThread();
+    void serve(int fd);
+    void serveOne(int fd, const std::string& headers, const std::string& body, bool keepAlive);
+    bool handle(int fd, const std::string& method, const std::string& path, const std::string& headers, const std::string& body, bool keepAlive);
+    std::string soap(const std::string& service, const std::string& action, const std::string& body);
+    void subscribe(int fd, const std::string& path, const std::string& headers);
+    void notify(const std::string& service);
+    void notifyOne(Subscription& sub);
+    std::string propertySet(const std::string& service);
+    void play();
+    void stopStream();
+
+    std::string deviceDescription() const;
+    std::string zoneGroupState() const;
+
+    unsigned m_port;
+    std::string m_room;
+    std::string m_uuid;
+    std::string m_host; // our address as seen by the controller
+    SimOptions m_options;
+    int m_listen;
+    std::atomic<bool> m_running;
+    std::thread* m_thread;
+
+    std::mutex m_mutex;
+    std::vector<Subscription> m_subscriptions;
+    unsigned m_nextSid;
+    std::string m_uri;
+    std::string m_state;
+    uint64_t m_playUs;
+    SonosSimClient* m_client;
+    std::thread* m_clientThread;
+    unsigned m_streams;
+};
+
+#endif /* SBUPNPSTUB_H */
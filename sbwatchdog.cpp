@@ -0,0 +1,96 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "sbwatchdog.h"
+#include "sbmetrics.h"
+#include "sbtrace.h"
+
+using namespace NSROOT;
+
+SBWatchdog::SBWatchdog()
+    : m_stream(0)
+    , m_lastMs(0)
+    , m_audioUs(0)
+    , m_sentBytes(0)
+    , m_streamAudioUs(0)
+    , m_armed(false)
+    , m_slow(0)
+    , m_slowSinceMs(0)
+    , m_stalledStream(0)
+    , m_stalledSinceMs(0)
+{
+}
+
+bool SBWatchdog::check(unsigned stream, uint64_t nowMs)
+{
+    if (nowMs - m_lastMs < SBWATCHDOG_INTERVAL_MS) {
+        return false;
+    }
+    int64_t audioUs = sbmetrics_get(SBM_ENCODED_AUDIO_US);
+    int64_t sentBytes = sbmetrics_get(SBM_HTTP_SENT_BYTES);
+    int64_t audio = audioUs - m_audioUs;
+    int64_t sent = sentBytes - m_sentBytes;
+    m_audioUs = audioUs;
+    m_sentBytes = sentBytes;
+    m_lastMs = nowMs;
+
+    if (stream != m_stream) {
+        // what happened in this interval may belong to either stream
+        m_stream = stream;
+        m_streamAudioUs = 0;
+        m_armed = false;
+        m_slow = 0;
+        return false;
+    }
+
+    if (m_stalledSinceMs && stream != m_stalledStream && sent > 0) {
+        int64_t ms = nowMs - m_stalledSinceMs;
+        sbmetrics_set(SBM_RECOVERY_MS, ms);
+        sbmetrics_add(SBM_RECOVERY_MS_TOTAL, ms);
+        sbtrace(SBT_STREAM_RECOVERED, stream, ms, 0);
+        m_stalledSinceMs = 0;
+    }
+
+    m_streamAudioUs += audio;
+    m_armed |= sent > 0;
+    if (!m_armed || audio <= 0 || m_streamAudioUs <= 0) {
+        m_slow = 0; // not pulled yet, or no audio (silence is not streamed)
+        return false;
+    }
+    int64_t expected = audio * sbmetrics_get(SBM_STREAM_ENCODED_BYTES) / m_streamAudioUs;
+    if (sent * 4 >= expected) {
+        m_slow = 0;
+        return false;
+    }
+    if (!m_slow++) {
+        m_slowSinceMs = nowMs - SBWATCHDOG_INTERVAL_MS;
+    }
+    if (m_slow < SBWATCHDOG_STALL_INTERVALS) {
+        return false;
+    }
+
+    sbtrace(SBT_STREAM_STALLED, stream, sent, expected);
+    sbmetrics_add(SBM_STALL_RECOVERIES, 1);
+    m_stalledStream = stream;
+    m_stalledSinceMs = m_slowSinceMs;
+    m_armed = false;
+    m_slow = 0;
+    return true;
+}
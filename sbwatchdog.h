@@ -0,0 +1,58 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SBWATCHDOG_H
+#define SBWATCHDOG_H
+
+#include "local_config.h"
+
+#include <cstdint>
+
+#define SBWATCHDOG_INTERVAL_MS 1000
+#define SBWATCHDOG_STALL_INTERVALS 5 // consecutive slow intervals before the stream is restarted
+
+namespace NSROOT {
+
+// Detects a stream that Sonos stopped pulling. Every interval the bytes sent to Sonos are compared
+// with the bytes the audio encoded in that interval needs (at the compression ratio of the stream
+// so far). Once the stream has been pulled from, a run of intervals where less than a quarter of
+// that was sent counts as a stall. Recovery time is measured until data flows on a new stream.
+class SBWatchdog {
+public:
+    SBWatchdog();
+
+    // call regularly with the current stream id; returns true when the stream should be restarted
+    bool check(unsigned stream, uint64_t nowMs);
+
+private:
+    unsigned m_stream;
+    uint64_t m_lastMs;
+    int64_t m_audioUs; // totals at the last check
+    int64_t m_sentBytes;
+    int64_t m_streamAudioUs; // audio encoded for m_stream
+    bool m_armed; // Sonos has pulled from m_stream
+    unsigned m_slow;
+    uint64_t m_slowSinceMs;
+    unsigned m_stalledStream;
+    uint64_t m_stalledSinceMs; // 0 = not recovering
+};
+}
+
+#endif /* SBWATCHDOG_H */
@@ -0,0 +1,409 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Encoder benchmark: pushes PCM through SBEncoder::write/read as fast as possible, using a virtual
+// clock so the 2 second throttle never waits. Reports throughput, real-time factor, heap
+// allocations in the steady state and the compression ratio.
+//
+//   ./sonos-bench [--seconds=20] [--file=<raw s16le stereo 44k1>] [--bits=8,16,24,32]
+//                 [--levels=0,5,8] [--blocks=0,4096] [--codec=flac|flac:fast|mp3:<kbit/s>,...]
+//
+// Several codecs are compared in one table, e.g. libFLAC against the in-tree encoder with
+// --bits=16 --levels=0,1,2,3,4,5 --codec=flac,flac:fast
+//
+//   ./sonos-bench --steady-state [--seconds=60] [--file=...] [--codec=...] [--profile=lowlatency]
+//
+// Streams music, and music with silences, once the way a room does (16-bit, level 5, read in HTTP
+// chunks) and fails when the heap is used after the first second, other than by libFLAC set up
+// again after a long silence, or when that happens more than once per silence.
+
+#include "sbbudget.h"
+#include "sbcodec.h"
+#include "sbencoder.h"
+#include "sbmetrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define CHUNK_FRAMES 2048 // frames per write, as delivered by the Sonos output module
+#define SAMPLE_RATE 44100
+#define WARMUP_S 1
+#define GAP_PERIOD_S 10 // of the corpus with silences
+
+// count heap allocations by interposing the glibc allocator
+static std::atomic<uint64_t> g_allocs(0);
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size) noexcept
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) noexcept
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) noexcept
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) noexcept
+{
+    __libc_free(ptr);
+}
+} // extern "C"
+
+namespace {
+
+class BenchContext : public SONOS::SBContext {
+public:
+    uint32_t timeMs() override { return 1000 + (uint32_t)(m_frames * 1000 / SAMPLE_RATE); }
+    unsigned streamId() override { return 1; }
+    void advance(unsigned frames) { m_frames += frames; }
+
+private:
+    uint64_t m_frames = 0;
+};
+
+struct Corpus {
+    std::string name;
+    std::vector<int16_t> pcm; // interleaved stereo
+    int silences; // long enough for libFLAC to be set up again after them, -1 = unknown
+};
+
+struct Result {
+    bool ok;
+    double seconds;
+    uint64_t pcmBytes;
+    uint64_t encodedBytes;
+    uint64_t allocs;
+};
+
+Corpus makeMusic(unsigned frames)
+{
+    Corpus c { "music", std::vector<int16_t>(frames * 2) };
+    uint32_t seed = 1;
+    for (unsigned i = 0; i < frames; ++i) {
+        double t = (double)i / SAMPLE_RATE;
+        double env = 0.5 + 0.4 * sin(2 * M_PI * 0.3 * t);
+        seed = seed * 1664525 + 1013904223;
+        double noise = ((int32_t)seed >> 16) / 32768.0 * 0.01;
+        double l = env * (0.5 * sin(2 * M_PI * 220 * t) + 0.3 * sin(2 * M_PI * 331 * t)) + noise;
+        double r = env * (0.5 * sin(2 * M_PI * 220 * t + 0.5) + 0.3 * sin(2 * M_PI * 441 * t)) + noise;
+        c.pcm[2 * i] = (int16_t)(l * 16000);
+        c.pcm[2 * i + 1] = (int16_t)(r * 16000);
+    }
+    return c;
+}
+
+Corpus makeNoise(unsigned frames)
+{
+    Corpus c { "noise", std::vector<int16_t>(frames * 2) };
+    uint32_t seed = 7;
+    for (int16_t& s : c.pcm) {
+        seed = seed * 1664525 + 1013904223;
+        s = (int16_t)(seed >> 16);
+    }
+    return c;
+}
+
+Corpus makeSilence(unsigned frames)
+{
+    return Corpus { "silence", std::vector<int16_t>(frames * 2, 0) };
+}
+
+// Music with a silence of 2 s every GAP_PERIOD_S, after which libFLAC is set up again, and one of
+// 0.3 s (the tail of a fade-out) in between, which libFLAC encodes itself.
+Corpus makeGaps(unsigned frames)
+{
+    Corpus c = makeMusic(frames);
+    c.name = "gaps";
+    const unsigned period = GAP_PERIOD_S * SAMPLE_RATE;
+    for (unsigned i = 0; i < frames; ++i) {
+        unsigned t = i % period;
+        if ((t >= 3 * SAMPLE_RATE && t < 3 * SAMPLE_RATE + SAMPLE_RATE * 3 / 10) || t >= period - 2 * SAMPLE_RATE) {
+            c.pcm[2 * i] = 0;
+            c.pcm[2 * i + 1] = 0;
+        }
+    }
+    c.silences = frames / period;
+    return c;
+}
+
+bool loadFile(const char* filename, unsigned frames, Corpus& c)
+{
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        printf("Unable to open %s\n", filename);
+        return false;
+    }
+    c.name = "file";
+    c.silences = -1;
+    c.pcm.resize(frames * 2);
+    size_t n = fread(c.pcm.data(), sizeof(int16_t), c.pcm.size(), f);
+    fclose(f);
+    c.pcm.resize(n - n % 2);
+    return n > 0;
+}
+
+// pack 16-bit samples into the little-endian layout SBEncoder expects for the given sample size
+std::vector<char> pack(const Corpus& c, int bits)
+{
+    int bytes = bits / 8;
+    std::vector<char> out(c.pcm.size() * bytes);
+    char* p = out.data();
+    for (int16_t s : c.pcm) {
+        int32_t v = (int32_t)s << (bits - 16 > 0 ? bits - 16 : 0);
+        switch (bits) {
+        case 8:
+            *p++ = (char)((s >> 8) + 128);
+            break;
+        default:
+            for (int i = 0; i < bytes; ++i) {
+                *p++ = (char)(v >> (8 * i));
+            }
+        }
+    }
+    return out;
+}
+
+Result run(const std::vector<char>& pcm, int bits, unsigned level, unsigned block)
+{
+    Result res = { false, 0, pcm.size(), 0, 0 };
+    BenchContext context;
+    SONOS::SBEncoder enc(1, &context);
+    if (!enc.open(bits, level, block)) {
+        return res;
+    }
+    const int bytesPerFrame = 2 * bits / 8;
+    const int chunk = CHUNK_FRAMES * bytesPerFrame;
+    static char buf[65536];
+    uint64_t allocs = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t off = 0; off < pcm.size(); off += chunk) {
+        int len = (int)std::min(pcm.size() - off, (size_t)chunk);
+        len -= len % bytesPerFrame;
+        if (off == (size_t)chunk) {
+            allocs = g_allocs.load(); // the first chunk is warm-up
+        }
+        enc.write(pcm.data() + off, len, 0);
+        context.advance(len / bytesPerFrame);
+        while (enc.bytesAvailable()) {
+            res.encodedBytes += enc.read(buf, sizeof(buf), 0);
+        }
+    }
+    res.allocs = allocs ? g_allocs.load() - allocs : 0;
+    enc.close();
+    res.encodedBytes += enc.bytesAvailable(); // last frame, written by finish()
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    res.ok = true;
+    return res;
+}
+
+// output -> encode -> send for one stream, returns the allocations after warm-up (or -1) and the
+// times libFLAC was set up again in that time
+int64_t steadyState(const Corpus& c, int64_t* setups)
+{
+    std::vector<char> pcm = pack(c, 16);
+    BenchContext context;
+    SONOS::SBEncoder enc(1, &context);
+    if (!enc.open()) {
+        return -1;
+    }
+    const int chunk = CHUNK_FRAMES * 4;
+    std::vector<char> send(sbbudget_get()->http_chunk + 16);
+    uint64_t allocs = 0;
+    for (size_t off = 0; off + chunk <= pcm.size(); off += chunk) {
+        if (off / 4 >= WARMUP_S * SAMPLE_RATE && !allocs) {
+            allocs = g_allocs.load();
+            *setups = sbmetrics_get(SBM_FLAC_SETUPS);
+        }
+        enc.write(pcm.data() + off, chunk, 0);
+        context.advance(CHUNK_FRAMES);
+        while (enc.bytesAvailable()) {
+            enc.read(send.data() + 7, (int)send.size() - 16, 0);
+        }
+    }
+    int64_t steady = allocs ? (int64_t)(g_allocs.load() - allocs) : 0;
+    *setups = allocs ? sbmetrics_get(SBM_FLAC_SETUPS) - *setups : 0;
+    enc.close();
+    return steady;
+}
+
+std::vector<std::string> splitList(const char* arg, const char* def)
+{
+    std::vector<std::string> list;
+    std::string s(arg ? arg : def);
+    for (size_t pos = 0; pos <= s.size();) {
+        size_t comma = s.find(',', pos);
+        if (comma == std::string::npos) {
+            comma = s.size();
+        }
+        list.push_back(s.substr(pos, comma - pos));
+        pos = comma + 1;
+    }
+    return list;
+}
+
+std::vector<unsigned> parseList(const char* arg, const std::vector<unsigned>& def)
+{
+    if (!arg) {
+        return def;
+    }
+    std::vector<unsigned> list;
+    for (const char* p = arg; *p;) {
+        list.push_back((unsigned)strtoul(p, (char**)&p, 10));
+        if (*p == ',') {
+            ++p;
+        } else if (*p) {
+            break;
+        }
+    }
+    return list;
+}
+
+const char* getCmdOption(int argc, char** argv, const std::string& option)
+{
+    char** end = argv + argc;
+    for (char** it = argv; it != end; ++it) {
+        if (strncmp(*it, option.c_str(), option.length()) == 0 && (*it)[option.length()] == '=')
+            return &((*it)[option.length() + 1]);
+    }
+    return NULL;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const char* seconds = getCmdOption(argc, argv, "--seconds");
+    const char* filename = getCmdOption(argc, argv, "--file");
+    std::vector<unsigned> bits = parseList(getCmdOption(argc, argv, "--bits"), { 8, 16, 24, 32 });
+    std::vector<unsigned> levels = parseList(getCmdOption(argc, argv, "--levels"), { 0, 5, 8 });
+    std::vector<unsigned> blocks = parseList(getCmdOption(argc, argv, "--blocks"), { 0, 4096 });
+    std::vector<std::string> codecs = splitList(getCmdOption(argc, argv, "--codec"), "flac");
+    const char* profile = getCmdOption(argc, argv, "--profile");
+    bool steady = std::find(argv, argv + argc, std::string("--steady-state")) != argv + argc;
+    unsigned frames = (seconds ? atoi(seconds) : steady ? 60 : 20) * SAMPLE_RATE;
+
+    for (const std::string& codec : codecs) {
+        if (!SONOS::SBCodec::configure(codec.c_str())) {
+            printf("Invalid codec: %s\n", codec.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    if (profile && !sbbudget_profile(profile)) {
+        printf("Invalid profile: %s\n", profile);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Corpus> corpora;
+    if (filename) {
+        Corpus c;
+        if (!loadFile(filename, frames, c)) {
+            return EXIT_FAILURE;
+        }
+        corpora.push_back(c);
+    } else if (steady) {
+        corpora.push_back(makeMusic(frames));
+        corpora.push_back(makeGaps(frames));
+    } else {
+        corpora.push_back(makeMusic(frames));
+        corpora.push_back(makeNoise(frames));
+        corpora.push_back(makeSilence(frames));
+    }
+
+    if (steady) {
+        bool ok = true;
+        for (const std::string& codec : codecs) {
+            SONOS::SBCodec::configure(codec.c_str());
+            sbbudget_configure(0, 0, SONOS::SBCodec::typicalBytesPerSecond(), SONOS::SBCodec::maxBytesPerSecond());
+            for (const Corpus& c : corpora) {
+                int64_t setups;
+                int64_t allocs = steadyState(c, &setups);
+                if (allocs < 0) {
+                    printf("%s: unable to open the encoder\n", codec.c_str());
+                    return EXIT_FAILURE;
+                }
+                printf("%s, %s: %lld heap allocations in %u s of streaming after %d s of warm-up", c.name.c_str(),
+                    codec.c_str(), (long long)allocs, frames / SAMPLE_RATE - WARMUP_S, WARMUP_S);
+                if (setups) {
+                    printf(", %lld per libFLAC setup after %lld silences", (long long)(allocs / setups), (long long)setups);
+                }
+                printf("\n");
+                if ((allocs && !setups) || (c.silences >= 0 && setups > c.silences)) {
+                    ok = false;
+                }
+            }
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    printf("+--------------------------------------------------------------------------------------------------+\n");
+    printf("| %-8s | %-12s | %4s | %5s | %5s | %9s | %10s | %12s | %8s |\n",
+        "corpus", "codec", "bits", "level", "block", "MB/s", "x realtime", "allocs/s", "ratio");
+    printf("+--------------------------------------------------------------------------------------------------+\n");
+    for (const Corpus& c : corpora) {
+        double audio = (double)c.pcm.size() / 2 / SAMPLE_RATE;
+        for (unsigned b : bits) {
+            std::vector<char> pcm = pack(c, b);
+            for (const std::string& codec : codecs) {
+                SONOS::SBCodec::configure(codec.c_str());
+                sbbudget_configure(0, 0, SONOS::SBCodec::typicalBytesPerSecond(), SONOS::SBCodec::maxBytesPerSecond());
+                for (unsigned level : levels) {
+                    for (unsigned block : blocks) {
+                        Result r = run(pcm, b, level, block);
+                        if (!r.ok) {
+                            printf("| %-8s | %-12s | %4u | %5u | %5u | %-51s |\n", c.name.c_str(), codec.c_str(), b, level, block,
+                                "encoder does not support this format");
+                            continue;
+                        }
+                        printf("| %-8s | %-12s | %4u | %5u | %5u | %9.1f | %10.1f | %12.1f | %8.3f |\n",
+                            c.name.c_str(), codec.c_str(), b, level, block,
+                            r.pcmBytes / r.seconds / 1e6,
+                            audio / r.seconds,
+                            r.allocs / audio,
+                            (double)r.encodedBytes / r.pcmBytes);
+                    }
+                }
+            }
+        }
+    }
+    printf("+--------------------------------------------------------------------------------------------------+\n");
+    return EXIT_SUCCESS;
+}
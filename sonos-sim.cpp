@@ -0,0 +1,156 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Simulated Sonos players for load testing SBStreamer without speakers.
+//
+//   ./sonos-sim --url=http://127.0.0.1:1400/music/squeezebox.flac?stream=1 [--rooms=N]
+//               [--duration=s] [--start-ms=2000] [--buffer-ms=6000] [--jitter=ms]
+//               [--stall=every_s:ms] [--reconnect=s] [--duplicate] [--no-head]
+//
+// With --rooms=N, room i requests the same path from port + i, matching the ports used by N
+// instances of sonos-squeezebox on one host.
+//
+//   ./sonos-sim --upnp-port=1400 [--room=name] [options above]
+//
+// Instead of pulling a given URL, act as a Sonos player that can be controlled over UPnP: start
+// sonos-squeezebox with --ip=127.0.0.1 --room=name and every PlayStream it issues is pulled.
+
+#include "sbsimclient.h"
+#include "sbupnpstub.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static const char* getCmd(int argc, char** argv, const std::string& option);
+static const char* getCmdOption(int argc, char** argv, const std::string& option);
+
+static std::string roomUrl(const std::string& url, unsigned room)
+{
+    if (!room) {
+        return url;
+    }
+    size_t host = url.find("://");
+    size_t path = url.find('/', host == std::string::npos ? 0 : host + 3);
+    size_t colon = url.rfind(':', path);
+    if (colon == std::string::npos || colon < host + 3) {
+        return url;
+    }
+    unsigned port = atoi(url.substr(colon + 1, path - colon - 1).c_str());
+    return url.substr(0, colon + 1) + std::to_string(port + room) + url.substr(path);
+}
+
+int main(int argc, char** argv)
+{
+    const char* url = getCmdOption(argc, argv, "--url");
+    const char* rooms = getCmdOption(argc, argv, "--rooms");
+    const char* duration = getCmdOption(argc, argv, "--duration");
+    const char* startMs = getCmdOption(argc, argv, "--start-ms");
+    const char* bufferMs = getCmdOption(argc, argv, "--buffer-ms");
+    const char* jitter = getCmdOption(argc, argv, "--jitter");
+    const char* stall = getCmdOption(argc, argv, "--stall");
+    const char* reconnect = getCmdOption(argc, argv, "--reconnect");
+    const char* upnpPort = getCmdOption(argc, argv, "--upnp-port");
+    const char* room = getCmdOption(argc, argv, "--room");
+
+    if (!url && !upnpPort) {
+        printf("Please specify the stream to pull with the --url option (or --upnp-port)\n");
+        return EXIT_FAILURE;
+    }
+
+    SimOptions options;
+    options.durationS = duration ? atoi(duration) : 0;
+    options.startMs = startMs ? atoi(startMs) : options.startMs;
+    options.bufferMs = bufferMs ? atoi(bufferMs) : options.bufferMs;
+    options.jitterMs = jitter ? atoi(jitter) : 0;
+    options.reconnectAfterS = reconnect ? atoi(reconnect) : 0;
+    options.duplicate = getCmd(argc, argv, "--duplicate") != NULL;
+    options.head = getCmd(argc, argv, "--no-head") == NULL;
+    if (stall) {
+        sscanf(stall, "%u:%u", &options.stallEveryS, &options.stallMs);
+    }
+
+    if (upnpPort) {
+        setvbuf(stdout, NULL, _IOLBF, 0); // progress is reported as it happens, also when redirected
+        SonosUPnPStub stub(atoi(upnpPort), room ? room : "Sim", options);
+        if (!stub.start()) {
+            return EXIT_FAILURE;
+        }
+        for (;;) {
+            pause();
+        }
+    }
+
+    unsigned count = rooms ? std::max(1, atoi(rooms)) : 1;
+    std::vector<SonosSimClient*> clients;
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < count; ++i) {
+        clients.push_back(new SonosSimClient(roomUrl(url, i), options));
+    }
+    for (SonosSimClient* client : clients) {
+        threads.emplace_back([client]() { client->run(); });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    int failed = 0;
+    SonosSimClient::printHeader();
+    for (unsigned i = 0; i < count; ++i) {
+        const SimStats& s = clients[i]->stats();
+        std::string name = "room " + std::to_string(i + 1);
+        clients[i]->printStats(name.c_str());
+        if (s.getStatus != 200 || s.chunkErrors || s.decodeErrors) {
+            ++failed;
+        }
+        if (options.duplicate && s.duplicateStatus != 429) {
+            printf("%s: duplicate request was answered with %d instead of 429\n", name.c_str(), s.duplicateStatus);
+            ++failed;
+        }
+        delete clients[i];
+    }
+    printf("+-------------------------------------------------------------------------------------------------------+\n");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static const char* getCmd(int argc, char** argv, const std::string& option)
+{
+    char** end = argv + argc;
+    char** itr = std::find(argv, end, option);
+    if (itr != end) {
+        return *itr;
+    }
+    return NULL;
+}
+
+static const char* getCmdOption(int argc, char** argv, const std::string& option)
+{
+    char** end = argv + argc;
+    for (char** it = argv; it != end; ++it) {
+        if (strncmp(*it, option.c_str(), option.length()) == 0 && (*it)[option.length()] == '=')
+            return &((*it)[option.length() + 1]);
+    }
+    return NULL;
+}
@@ -0,0 +1,428 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "sonos-soap.h"
+#include "sbmetrics.h"
+#include "sbtrace.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace NSROOT;
+
+namespace {
+
+std::mutex g_poolsMutex;
+std::map<std::string, std::weak_ptr<SoapPool>> g_pools;
+
+std::string controlPath(const std::string& service)
+{
+    if (service == "ZoneGroupTopology" || service == "AlarmClock" || service == "SystemProperties") {
+        return "/" + service + "/Control";
+    }
+    return "/MediaRenderer/" + service + "/Control";
+}
+
+std::string unescape(std::string str)
+{
+    static const char* entities[][2] = { { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" }, { "&apos;", "'" }, { "&amp;", "&" } };
+    for (auto& e : entities) {
+        size_t pos = 0;
+        while ((pos = str.find(e[0], pos)) != std::string::npos) {
+            str.replace(pos, strlen(e[0]), e[1]);
+            pos += strlen(e[1]);
+        }
+    }
+    return str;
+}
+
+std::string header(const std::string& headers, const char* name)
+{
+    size_t len = strlen(name);
+    size_t pos = 0;
+    while ((pos = headers.find("\r\n", pos)) != std::string::npos) {
+        pos += 2;
+        if (strncasecmp(headers.c_str() + pos, name, len) == 0 && headers[pos + len] == ':') {
+            size_t begin = headers.find_first_not_of(' ', pos + len + 1);
+            return headers.substr(begin, headers.find("\r\n", begin) - begin);
+        }
+    }
+    return "";
+}
+
+bool sendAll(int fd, const std::string& data)
+{
+    const char* p = data.data();
+    size_t len = data.length();
+    while (len) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// appends to the buffer, false on a closed connection or timeout
+bool fill(int fd, std::string& buffer)
+{
+    char buf[4096];
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+        return false;
+    }
+    buffer.append(buf, n);
+    return true;
+}
+
+} // namespace
+
+std::string SoapCall::value(const std::string& tag) const
+{
+    size_t begin = response.find("<" + tag + ">");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    begin += tag.length() + 2;
+    size_t end = response.find("</" + tag + ">", begin);
+    return unescape(response.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+}
+
+std::shared_ptr<SoapPool> SoapPool::get(const std::string& host, unsigned port)
+{
+    std::string key = host + ":" + std::to_string(port);
+    std::lock_guard<std::mutex> lock(g_poolsMutex);
+    std::shared_ptr<SoapPool> pool = g_pools[key].lock();
+    if (!pool) {
+        pool.reset(new SoapPool(host, port));
+        g_pools[key] = pool;
+    }
+    return pool;
+}
+
+SoapPool::SoapPool(const std::string& host, unsigned port)
+    : m_host(host)
+    , m_port(port)
+    , m_open(0)
+    , m_busy(0)
+{
+}
+
+SoapPool::~SoapPool()
+{
+    for (Connection* c : m_idle) {
+        close(c->fd);
+        delete c;
+    }
+}
+
+std::string SoapPool::escape(const std::string& str)
+{
+    std::string out;
+    for (char c : str) {
+        switch (c) {
+        case '&':
+            out.append("&amp;");
+            break;
+        case '<':
+            out.append("&lt;");
+            break;
+        case '>':
+            out.append("&gt;");
+            break;
+        case '"':
+            out.append("&quot;");
+            break;
+        default:
+            out.push_back(c);
+        }
+    }
+    return out;
+}
+
+bool SoapPool::call(SoapCall& call, bool urgent /*= false*/)
+{
+    return this->call(std::vector<SoapCall*> { &call }, urgent);
+}
+
+bool SoapPool::call(const std::vector<SoapCall*>& calls, bool urgent /*= false*/)
+{
+    uint64_t t = sbtrace_begin();
+    uint64_t begin_us = sbtrace_now_us();
+    size_t done = 0;
+    bool fresh = false;
+    Connection* c = take(urgent, &fresh);
+    if (c) {
+        std::string out;
+        for (SoapCall* call : calls) {
+            out.append(request(*call));
+        }
+        if (sendAll(c->fd, out)) {
+            for (; done < calls.size(); ++done) {
+                if (receive(c, *calls[done]) < 0) {
+                    break;
+                }
+            }
+        }
+        if (done < calls.size() || c->closing) {
+            drop(c, !urgent);
+        } else {
+            give(c, !urgent);
+        }
+    }
+    // closed by the player in the meantime, or not pipelining: the rest one by one, fresh. Not
+    // when no connection was made or a new one got no reply: connecting again would only take as
+    // long once more.
+    while (c && (!fresh || done) && done < calls.size()) {
+        sbmetrics_add(SBM_SOAP_RETRIES, 1);
+        c = connect();
+        if (c) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_open;
+        }
+        int r = -1;
+        if (c && sendAll(c->fd, request(*calls[done]))) {
+            r = receive(c, *calls[done]);
+        }
+        if (c) {
+            if (r < 0 || c->closing) {
+                drop(c, false); // not counted as busy
+            } else {
+                give(c, false);
+            }
+        }
+        if (r < 0) {
+            break; // unreachable, the remaining calls fail as well
+        }
+        ++done;
+    }
+
+    bool ok = true;
+    for (SoapCall* call : calls) {
+        ok &= call->ok;
+        if (!call->ok) {
+            sbtrace(SBT_SOAP_FAILED, 0, calls.size(), 0);
+        }
+    }
+    uint64_t us = sbtrace_now_us() - begin_us;
+    sbmetrics_add(SBM_SOAP_CALLS, calls.size());
+    sbmetrics_add(SBM_SOAP_US, us);
+    sbmetrics_set(SBM_SOAP_LAST_US, us);
+    sbtrace_end(SBS_SOAP, 0, t, calls.size());
+    return ok;
+}
+
+// Calls that are not urgent have at most SOAP_POOL_SIZE connections, so an urgent call finds one
+// idle or room to connect, unless another urgent call holds it. An urgent call waits for that
+// SOAP_URGENT_WAIT_MS and then connects beyond the pool; the others fail after SOAP_TIMEOUT_MS.
+SoapPool::Connection* SoapPool::take(bool urgent, bool* fresh)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    bool available = m_cond.wait_for(lock, std::chrono::milliseconds(urgent ? SOAP_URGENT_WAIT_MS : SOAP_TIMEOUT_MS), [this, urgent]() {
+        if (urgent) {
+            return !m_idle.empty() || m_open < SOAP_POOL_SIZE + SOAP_POOL_URGENT;
+        }
+        return m_busy < SOAP_POOL_SIZE && (!m_idle.empty() || m_open < SOAP_POOL_SIZE);
+    });
+    if (!available && !urgent) {
+        sbtrace(SBT_SOAP_BUSY, 0, m_busy, m_open);
+        return nullptr;
+    }
+    m_busy += urgent ? 0 : 1;
+    while (!m_idle.empty()) {
+        Connection* c = m_idle.back();
+        m_idle.pop_back();
+        // an idle connection has nothing to read, unless the player closed it
+        struct pollfd p = { c->fd, POLLIN, 0 };
+        if (poll(&p, 1, 0) == 0) {
+            *fresh = false;
+            return c;
+        }
+        sbmetrics_add(SBM_SOAP_RETRIES, 1);
+        close(c->fd);
+        delete c;
+        --m_open;
+    }
+    ++m_open;
+    lock.unlock();
+    Connection* c = connect();
+    *fresh = true;
+    if (!c) {
+        lock.lock();
+        --m_open;
+        m_busy -= urgent ? 0 : 1;
+        m_cond.notify_all();
+    }
+    return c;
+}
+
+void SoapPool::give(Connection* c, bool busy)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_busy -= busy ? 1 : 0;
+    if (m_open > SOAP_POOL_SIZE + SOAP_POOL_URGENT) {
+        --m_open; // a retry connection beyond the pool
+        close(c->fd);
+        delete c;
+    } else {
+        m_idle.push_back(c);
+    }
+    m_cond.notify_all(); // urgent and other callers wait for different conditions
+}
+
+void SoapPool::drop(Connection* c, bool busy)
+{
+    close(c->fd);
+    delete c;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    --m_open;
+    m_busy -= busy ? 1 : 0;
+    m_cond.notify_all();
+}
+
+// the caller counts it in m_open, give() and drop() take it out again
+SoapPool::Connection* SoapPool::connect()
+{
+    struct addrinfo hints = {};
+    struct addrinfo* res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(m_host.c_str(), std::to_string(m_port).c_str(), &hints, &res) != 0 || !res) {
+        return nullptr;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, 0);
+    bool ok = fd >= 0;
+    if (ok) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        if (::connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+            struct pollfd p = { fd, POLLOUT, 0 };
+            int err = 0;
+            socklen_t len = sizeof(err);
+            ok = errno == EINPROGRESS && poll(&p, 1, SOAP_CONNECT_TIMEOUT_MS) == 1
+                && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+        }
+    }
+    freeaddrinfo(res);
+    if (!ok) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        sbtrace(SBT_SOAP_CONNECT_FAILED, 0, m_port, 0);
+        return nullptr;
+    }
+    fcntl(fd, F_SETFL, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval tv = { SOAP_TIMEOUT_MS / 1000, (SOAP_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    sbmetrics_add(SBM_SOAP_CONNECTS, 1);
+    return new Connection { fd, 0, false, std::string() };
+}
+
+std::string SoapPool::request(const SoapCall& call) const
+{
+    std::string type = "urn:schemas-upnp-org:service:" + call.service + ":1";
+    std::string body = "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+                       "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+                       "<s:Body><u:"
+        + call.action + " xmlns:u=\"" + type + "\">" + call.args + "</u:" + call.action + "></s:Body></s:Envelope>";
+    return "POST " + controlPath(call.service) + " HTTP/1.1\r\n"
+        + "Host: " + m_host + ":" + std::to_string(m_port) + "\r\n"
+        + "Content-Type: text/xml; charset=\"utf-8\"\r\n"
+        + "SOAPACTION: \"" + type + "#" + call.action + "\"\r\n"
+        + "Content-Length: " + std::to_string(body.length()) + "\r\n"
+        + "Connection: keep-alive\r\n\r\n"
+        + body;
+}
+
+int SoapPool::receive(Connection* c, SoapCall& call)
+{
+    call.ok = false;
+    call.response.clear();
+    size_t end;
+    while ((end = c->buffer.find("\r\n\r\n")) == std::string::npos) {
+        if (!fill(c->fd, c->buffer)) {
+            return -1;
+        }
+    }
+    std::string headers = c->buffer.substr(0, end + 2);
+    c->buffer.erase(0, end + 4);
+    int status = 0;
+    if (sscanf(headers.c_str(), "HTTP/1.%*d %d", &status) != 1) {
+        return -1;
+    }
+    std::string connection = header(headers, "Connection");
+    c->closing = strncasecmp(connection.c_str(), "close", 5) == 0 || headers.compare(0, 8, "HTTP/1.0") == 0;
+    if (strncasecmp(header(headers, "Transfer-Encoding").c_str(), "chunked", 7) == 0) {
+        for (;;) {
+            size_t eol;
+            while ((eol = c->buffer.find("\r\n")) == std::string::npos) {
+                if (!fill(c->fd, c->buffer)) {
+                    return -1;
+                }
+            }
+            size_t size = strtoul(c->buffer.c_str(), nullptr, 16);
+            while (c->buffer.length() < eol + 2 + size + 2) {
+                if (!fill(c->fd, c->buffer)) {
+                    return -1;
+                }
+            }
+            call.response.append(c->buffer, eol + 2, size);
+            c->buffer.erase(0, eol + 2 + size + 2);
+            if (!size) {
+                break; // no trailers expected
+            }
+        }
+    } else {
+        std::string length = header(headers, "Content-Length");
+        if (length.empty()) {
+            c->closing = true; // the body ends with the connection
+            while (fill(c->fd, c->buffer)) { }
+            call.response.swap(c->buffer);
+        } else {
+            size_t size = strtoul(length.c_str(), nullptr, 10);
+            while (c->buffer.length() < size) {
+                if (!fill(c->fd, c->buffer)) {
+                    return -1;
+                }
+            }
+            call.response.assign(c->buffer, 0, size);
+            c->buffer.erase(0, size);
+        }
+    }
+    ++c->requests;
+    call.ok = status >= 200 && status < 300;
+    return call.ok ? 1 : 0;
+}
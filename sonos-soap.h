@@ -0,0 +1,101 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SONOS_SOAP_H
+#define SONOS_SOAP_H
+
+#include "local_config.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define SOAP_POOL_SIZE 2 // connections per player for status and volume
+#define SOAP_POOL_URGENT 1 // kept on top of those for starting a stream
+#define SOAP_CONNECT_TIMEOUT_MS 2000
+#define SOAP_TIMEOUT_MS 5000
+#define SOAP_URGENT_WAIT_MS 100 // then an urgent call connects beyond the pool
+
+namespace NSROOT {
+
+struct SoapCall {
+    SoapCall(const std::string& service, const std::string& action, const std::string& args)
+        : service(service)
+        , action(action)
+        , args(args)
+        , ok(false)
+    {
+    }
+    std::string service; // AVTransport, RenderingControl, ...
+    std::string action;
+    std::string args; // the in arguments, as XML elements
+    std::string response; // body of the reply
+    bool ok;
+
+    std::string value(const std::string& tag) const; // out argument
+};
+
+// UPnP control of one player over persistent HTTP/1.1 connections, instead of a new connection
+// for every action. Calls that do not depend on each other can be pipelined: they are sent at
+// once and the replies are read in order. When the player has closed a kept connection (or does
+// not answer a pipelined request) the calls without a reply are sent again on a new connection.
+//
+// Urgent calls (starting a stream) never queue behind the others: those use at most
+// SOAP_POOL_SIZE connections, the rest is kept for urgent calls. Waiting for a connection is
+// bounded; when the player cannot be reached the calls fail at once, without connecting again.
+class SoapPool {
+public:
+    static std::shared_ptr<SoapPool> get(const std::string& host, unsigned port); // shared per player
+    ~SoapPool();
+
+    bool call(SoapCall& call, bool urgent = false);
+    bool call(const std::vector<SoapCall*>& calls, bool urgent = false); // pipelined, true when all succeeded
+
+    static std::string escape(const std::string& str);
+
+private:
+    struct Connection {
+        int fd;
+        unsigned requests; // answered on this connection
+        bool closing; // the player will close it after the last reply
+        std::string buffer; // received beyond the last reply
+    };
+
+    SoapPool(const std::string& host, unsigned port);
+    Connection* take(bool urgent, bool* fresh);
+    void give(Connection* c, bool busy); // busy: counted in m_busy by take()
+    void drop(Connection* c, bool busy);
+    Connection* connect();
+    int receive(Connection* c, SoapCall& call); // 1 = success, 0 = fault, -1 = connection lost
+    std::string request(const SoapCall& call) const;
+
+    std::string m_host;
+    unsigned m_port;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<Connection*> m_idle;
+    unsigned m_open;
+    unsigned m_busy; // taken by calls that are not urgent
+};
+}
+
+#endif /* SONOS_SOAP_H */
@@ -24,20 +24,40 @@
 #include <sonosplayer.h>
 #include <sonossystem.h>
 
+#include "metricsbroker.h"
+#include "sbbudget.h"
+#include "sbcodec.h"
+#include "sbhandover.h"
+#include "sbmetrics.h"
+#include "sbsched.h"
 #include "sbstreamer.h"
+#include "sbwatchdog.h"
 #include "sonos-status.h"
+#include "sonos-soap.h"
+#include "sonos-topology.h"
+#include "sonos-volume.h"
+#include "sbtrace.h"
 
 extern "C" {
 unsigned get_squeezebox_stream_id(void);
+void restart_squeezebox_stream(void);
+void set_skip_restart_ms(unsigned ms);
 }
 
 #include <algorithm>
+#include <csignal>
+#include <future>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unistd.h>
 
-void squeezelite(const char* server, uint8_t * mac, const char* name);
+void squeezelite_init(void);
+std::string squeezelite_discover(int timeout_ms);
+void squeezelite_run(const char* server, uint8_t* mac, const char* name);
 static void handleEvent(void* handle);
+static void handleTopologyEvent(void* handle);
+static void handleReexec(int signum);
 static const char* getCmd(int argc, char** argv, const std::string& option);
 static const char* getCmdOption(int argc, char** argv, const std::string& option);
 
@@ -45,6 +65,19 @@ SONOS::System* gSonos = 0;
 SONOS::PlayerPtr gPlayer;
 uint8_t gMac[6];
 volatile bool gEvent = true;
+volatile bool gTopologyChanged = false;
+volatile bool gTopologyEvent = false;
+volatile sig_atomic_t gReexec = 0;
+SONOS::Topology gTopology; // from the last background discovery
+std::mutex gTopologyMutex;
+bool gMlock = false;
+
+struct StartupPhase {
+    const char* name;
+    uint64_t us;
+};
+std::vector<StartupPhase> gStartup;
+std::mutex gStartupMutex;
 
 static std::string urlEncode(std::string str)
 {
@@ -61,12 +94,192 @@ static std::string urlEncode(std::string str)
     return new_str;
 }
 
-void squeezelite_thread(const char* server, std::string name)
+static void startupPhase(const char* name)
 {
-    squeezelite(server, gMac, name.c_str());
+    std::lock_guard<std::mutex> lock(gStartupMutex);
+    gStartup.push_back({ name, sbtrace_now_us() });
+}
+
+static void printStartup()
+{
+    std::lock_guard<std::mutex> lock(gStartupMutex);
+    std::sort(gStartup.begin(), gStartup.end(), [](const StartupPhase& a, const StartupPhase& b) { return a.us < b.us; });
+    printf("+--------------------------------------------------------------------------------- startup ---+\n");
+    printf("| %-75s | %13s |\n", "phase", "ms");
+    printf("+---------------------------------------------------------------------------------------------+\n");
+    for (const StartupPhase& phase : gStartup) {
+        printf("| %-75s | %13.1f |\n", phase.name, (phase.us - gStartup[0].us) / 1000.0);
+    }
+    printf("+---------------------------------------------------------------------------------------------+\n\n");
+}
+
+// Output, decoder and LMS discovery do not depend on Sonos and run while main() connects to it.
+// Only slimproto needs the player MAC, which main() supplies as soon as the coordinator is known.
+// Without --server slimproto gets no address: it then discovers LMS itself and again whenever it
+// keeps failing to connect, so a server that moves is found. The early round only reports it.
+void squeezelite_thread(const char* server, std::string name, std::future<void> mac)
+{
+    squeezelite_init();
+    startupPhase("squeezelite initialised");
+    if (gMlock) {
+        sbsched_mlock(); // the squeezelite buffers are allocated by now
+    }
+    if (!server) {
+        std::string lms = squeezelite_discover(5000);
+        if (lms.empty()) {
+            printf("No LMS answered discovery yet, slimproto keeps looking\n");
+        } else {
+            printf("LMS found at %s\n", lms.c_str());
+            startupPhase("LMS discovered");
+        }
+    }
+    mac.wait();
+    startupPhase("slimproto started");
+    squeezelite_run(server, gMac, name.c_str());
     printf("squeezelite_thread: stopped\n");
 }
 
+// --sched and --cpus apply to every role, --sched-<role> and --cpus-<role> override them. The CPUs
+// given with --cpus are set on the process right away, so every thread started later inherits them.
+static bool configureScheduling(int argc, char** argv)
+{
+    const char* sched = getCmdOption(argc, argv, "--sched");
+    const char* cpus = getCmdOption(argc, argv, "--cpus");
+    if (cpus && !sbsched_process_cpus(cpus)) {
+        printf("Invalid CPU list: %s\n", cpus);
+        return false;
+    }
+    for (int i = 0; i < SBR_COUNT; ++i) {
+        sbsched_role role = (sbsched_role)i;
+        std::string name = sbsched_name(role);
+        const char* roleSched = getCmdOption(argc, argv, "--sched-" + name);
+        const char* roleCpus = getCmdOption(argc, argv, "--cpus-" + name);
+        const char* spec = roleSched ? roleSched : sched;
+        if (spec && !sbsched_policy(role, spec)) {
+            printf("Invalid scheduling policy for the %s thread: %s\n", name.c_str(), spec);
+            return false;
+        }
+        if (roleCpus && !sbsched_cpus(role, roleCpus)) {
+            printf("Invalid CPU list for the %s thread: %s\n", name.c_str(), roleCpus);
+            return false;
+        }
+    }
+    gMlock = getCmd(argc, argv, "--mlock") != NULL;
+    return true;
+}
+
+// Full (SSDP) discovery after a start from the cache, on a separate system so the connection in
+// use is left alone. The main loop only reconnects when the coordinator of the room has changed.
+void rediscover_thread(std::string cacheFile, SONOS::Topology known)
+{
+    SONOS::System probe(0, 0);
+    if (!probe.Discover()) {
+        return;
+    }
+    SONOS::Topology found(&probe);
+    if (found != known) {
+        printf("Sonos topology has changed, updating %s\n", cacheFile.c_str());
+        found.save(cacheFile);
+        std::lock_guard<std::mutex> lock(gTopologyMutex);
+        gTopology = found;
+        gTopologyChanged = true;
+    }
+}
+
+// The zone a room is part of: the zone with that name, or the group that has it as a member.
+static SONOS::ZonePtr findZone(const std::string& room)
+{
+    SONOS::ZoneList zones = gSonos->GetZoneList();
+    for (SONOS::ZoneList::const_iterator iz = zones.begin(); iz != zones.end(); ++iz) {
+        if (iz->second->GetZoneName() == room) {
+            return iz->second;
+        }
+    }
+    for (SONOS::ZoneList::const_iterator iz = zones.begin(); iz != zones.end(); ++iz) {
+        for (const SONOS::ZonePlayerPtr& member : *iz->second) {
+            if (*member == room) {
+                return iz->second;
+            }
+        }
+    }
+    return SONOS::ZonePtr();
+}
+
+// Called on topology events: when the room was grouped or ungrouped its coordinator changes, so
+// the player handle and status are rebound and the stream is restarted towards the new
+// coordinator. squeezelite (and the MAC LMS knows us by) is left untouched.
+static void followRoom(const std::string& room, SONOS::Status& status, SONOS::VolumeSync* volume)
+{
+    SONOS::ZonePtr zone = findZone(room);
+    if (!zone || !zone->GetCoordinator()) {
+        return; // the room is (temporarily) gone and we keep what we have
+    }
+    status.setGroup(zone->size() > 1); // players may join or leave without a new coordinator
+    if (volume) {
+        volume->setGroup(zone->size() > 1);
+    }
+    if (zone->GetCoordinator()->GetUUID() == status.get_uuid()) {
+        return;
+    }
+    printf("Room %s is now coordinated by %s ... ", room.c_str(), zone->GetCoordinator()->c_str());
+    SONOS::PlayerPtr player = gSonos->GetPlayer(zone, 0, handleEvent);
+    if (!player) {
+        printf("FAILED to connect\n");
+        return;
+    }
+    gPlayer = player;
+    status.rebind(gPlayer);
+    if (volume) {
+        volume->rebind(gPlayer);
+    }
+    restart_squeezebox_stream();
+    printf("SUCCESS\n");
+}
+
+static void reconcileTopology(const std::string& room, SONOS::Status& status, SONOS::VolumeSync* volume)
+{
+    SONOS::Topology found;
+    {
+        std::lock_guard<std::mutex> lock(gTopologyMutex);
+        found = gTopology;
+    }
+    const SONOS::Topology::Player* coordinator = found.coordinator(room);
+    if (!coordinator || (coordinator->uuid == status.get_uuid() && coordinator->host == gPlayer->GetHost())) {
+        return;
+    }
+    printf("Reconnecting to Sonos (through player %s) ... ", coordinator->host.c_str());
+    if (gSonos->Discover("http://" + coordinator->host + ":" + std::to_string(coordinator->port))) {
+        printf("SUCCESS\n");
+        followRoom(room, status, volume);
+    } else {
+        printf("FAILED, staying on the current connection\n");
+    }
+}
+
+// SetAVTransportURI and Play on a kept connection of the player, where noson's PlayStream opens
+// a connection for each. When that fails, this one stream is started with PlayStream and the next
+// stream tries the kept connection again.
+static bool playStream(const std::string& url, const std::string& title, const std::string& icon, const std::string& contentType)
+{
+    std::string didl = "<DIDL-Lite xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\" "
+                       "xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\"><item id=\"-1\" parentID=\"-1\" restricted=\"true\">"
+                       "<res protocolInfo=\"http-get:*:"
+        + contentType + ":*\">" + SONOS::SoapPool::escape(url) + "</res><dc:title>" + SONOS::SoapPool::escape(title)
+        + "</dc:title><upnp:albumArtURI>" + SONOS::SoapPool::escape(icon)
+        + "</upnp:albumArtURI><upnp:class>object.item.audioItem.audioBroadcast</upnp:class></item></DIDL-Lite>";
+    std::shared_ptr<SONOS::SoapPool> soap = SONOS::SoapPool::get(gPlayer->GetHost(), gPlayer->GetPort());
+    SONOS::SoapCall setUri("AVTransport", "SetAVTransportURI", "<InstanceID>0</InstanceID><CurrentURI>" + SONOS::SoapPool::escape(url)
+            + "</CurrentURI><CurrentURIMetaData>" + SONOS::SoapPool::escape(didl) + "</CurrentURIMetaData>");
+    SONOS::SoapCall play("AVTransport", "Play", "<InstanceID>0</InstanceID><Speed>1</Speed>");
+    if (soap->call(setUri, true) && soap->call(play, true)) {
+        return true;
+    }
+    if (!setUri.ok && !setUri.response.empty()) {
+        printf("Sonos rejected SetAVTransportURI, using PlayStream for this stream\n");
+    }
+    return gPlayer->PlayStream(url, title, icon);
+}
+
 bool PlaySqueezeBox(unsigned stream_id)
 {
     SONOS::RequestBroker::ResourcePtr res(nullptr);
@@ -82,7 +295,7 @@ bool PlaySqueezeBox(unsigned stream_id)
         iconURL.assign(gPlayer->GetControllerUri()).append(res->iconUri);
         std::string _title = res->description;
         _title.replace(res->description.find("%s"), 2, "g7700k");
-        return gPlayer->PlayStream(streamURL, _title, iconURL);
+        return playStream(streamURL, _title, iconURL, res->contentType);
     }
     printf("%s: service unavaible\n", __FUNCTION__);
     return false;
@@ -101,40 +314,118 @@ int main(int argc, char** argv)
     const char* room = getCmdOption(argc, argv, "--room");
     const char* filename = getCmdOption(argc, argv, "--file");
     const char* server = getCmdOption(argc, argv, "--server");
+    const char* traceFile = getCmdOption(argc, argv, "--trace-file");
+    const char* cache = getCmdOption(argc, argv, "--cache");
+    const char* latency = getCmdOption(argc, argv, "--latency");
+    const char* memoryBudget = getCmdOption(argc, argv, "--memory-budget");
+    const char* codec = getCmdOption(argc, argv, "--codec");
+    const char* skipRestart = getCmdOption(argc, argv, "--skip-restart");
+    const char* profile = getCmdOption(argc, argv, "--profile");
+    const char* handover = getCmdOption(argc, argv, "--handover");
 
     printf("\n\n| SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment\n|\n");
     printf("| Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>\n\n\n");
 
     SONOS::System::Debug(debug_level);
+    if (!configureScheduling(argc, argv)) {
+        return EXIT_FAILURE;
+    }
+    if (codec && !SONOS::SBCodec::configure(codec)) {
+        printf("Invalid codec: %s (use flac, flac:fast or mp3:<32-320 kbit/s>)\n", codec);
+        return EXIT_FAILURE;
+    }
+    sbmetrics_set(SBM_CODEC_KBPS, SONOS::SBCodec::config().kbps);
+    if (profile && !sbbudget_profile(profile)) {
+        printf("Invalid profile: %s (use default or lowlatency)\n", profile);
+        return EXIT_FAILURE;
+    }
+    if (skipRestart) {
+        set_skip_restart_ms(atoi(skipRestart));
+    }
+    if (!sbbudget_configure(latency ? atoi(latency) : 0, memoryBudget ? atoi(memoryBudget) : 0,
+            SONOS::SBCodec::typicalBytesPerSecond(), SONOS::SBCodec::maxBytesPerSecond())) {
+        printf("A memory budget of %s KB does not fit %d ms of audio\n", memoryBudget, SBBUDGET_MIN_LATENCY_MS);
+        return EXIT_FAILURE;
+    }
+    if (profile) {
+        const struct sbbudget* budget = sbbudget_get();
+        printf("Profile %s: %u ms lead, HTTP chunk %u KB\n", profile, budget->lead_ms, budget->http_chunk / 1024);
+    }
+    if (latency || memoryBudget) {
+        const struct sbbudget* budget = sbbudget_get();
+        printf("Buffers for %u ms: stream %u KB, output %u KB, HTTP chunk %u KB, %u KB in total\n\n",
+            budget->latency_ms, budget->streambuf_size / 1024, budget->outputbuf_size / 1024, budget->http_chunk / 1024,
+            (unsigned)(sbbudget_bytes() / 1024));
+    }
+    if (traceFile) {
+        sbtrace_spans(traceFile);
+    }
+    sbtrace_init(getCmd(argc, argv, "--trace-dump") != NULL);
 
-    gSonos = new SONOS::System(0, handleEvent);
+    startupPhase("start");
+    if (handover && room && !filename && SONOS::SBHandover::takeover(handover)) {
+        startupPhase("taken over");
+    }
+    gSonos = new SONOS::System(0, handleTopologyEvent);
+
+    // With the room found in the cache, slimproto is started right away (its MAC is derived from
+    // the coordinator) and Sonos is reached through the cached coordinator instead of SSDP.
+    std::string cacheFile = cache ? cache : SONOS::Topology::defaultFile();
+    SONOS::Topology cached;
+    const SONOS::Topology::Player* cachedCoordinator = nullptr;
+    if (room && !filename && cached.load(cacheFile)) {
+        cachedCoordinator = cached.coordinator(room);
+    }
 
-    if (!ip) {
-        printf("Connecting to Sonos ... ");
-        fflush(stdout);
-        if (!gSonos->Discover()) {
-            printf("No devices found (try specifying known Sonos player ip-address).\n");
-            return EXIT_FAILURE;
-        } else {
-            printf("SUCCESS\n\n");
-        }
-    } else {
+    std::thread* t = 0;
+    std::promise<void> macKnown;
+    if (room && !filename) {
+        t = new std::thread(squeezelite_thread, server, "SONOS::" + std::string(room), macKnown.get_future());
+    }
+    bool cachedMac = cachedCoordinator != nullptr;
+    if (cachedMac) {
+        SONOS::Topology::mac(cachedCoordinator->uuid, gMac);
+        macKnown.set_value();
+        startupPhase("MAC known (cache)");
+    }
+
+    bool connected = false;
+    if (ip) {
         std::string deviceUrl = "http://" + std::string(ip) + ":1400";
         printf("Connecting to Sonos (through player %s) ... ", ip);
         fflush(stdout);
         if (!gSonos->Discover(deviceUrl)) {
             printf("Device is unreachable.\n");
             return EXIT_FAILURE;
-        } else {
-            printf("SUCCESS\n\n");
+        }
+        connected = true;
+    } else if (cachedCoordinator) {
+        std::string deviceUrl = "http://" + cachedCoordinator->host + ":" + std::to_string(cachedCoordinator->port);
+        printf("Connecting to Sonos (through cached player %s) ... ", cachedCoordinator->host.c_str());
+        fflush(stdout);
+        connected = gSonos->Discover(deviceUrl);
+        if (!connected) {
+            printf("FAILED\n");
+            cachedCoordinator = nullptr;
+        }
+    }
+    if (!connected) {
+        printf("Connecting to Sonos ... ");
+        fflush(stdout);
+        if (!gSonos->Discover()) {
+            printf("No devices found (try specifying known Sonos player ip-address).\n");
+            return EXIT_FAILURE;
         }
     }
+    printf("SUCCESS\n\n");
+    startupPhase("Sonos connected");
 
     {
         SONOS::RequestBrokerPtr imageService(new SONOS::ImageService());
         gSonos->RegisterRequestBroker(imageService);
         gSonos->RegisterRequestBroker(SONOS::RequestBrokerPtr(new SONOS::SBStreamer(imageService.get())));
         gSonos->RegisterRequestBroker(SONOS::RequestBrokerPtr(new SONOS::FileStreamer()));
+        gSonos->RegisterRequestBroker(SONOS::RequestBrokerPtr(new SONOS::MetricsBroker()));
     }
 
     printf("+----------------------------------------------------------------------- devices / players ---+\n");
@@ -164,30 +455,42 @@ int main(int argc, char** argv)
 
     printf("Connecting to room %s ... ", room);
 
-    std::string zone = room;
-    bool found = false;
-    for (SONOS::ZoneList::const_iterator iz = zones.begin(); iz != zones.end(); ++iz) {
-        if (iz->second->GetZoneName() == zone) { // zone == room
-            found = true;
-            if ((gPlayer = gSonos->GetPlayer(iz->second, 0, handleEvent))) {
-                printf("SUCCESS");
-            } else {
-                printf("FAILED to connect\n");
-                return EXIT_FAILURE;
-            }
-            break;
-        }
-    }
-    if (!found) {
+    SONOS::ZonePtr zone = findZone(room);
+    if (!zone) {
         printf("FAILED to find room\n");
         return EXIT_FAILURE;
     }
+    if ((gPlayer = gSonos->GetPlayer(zone, 0, handleEvent))) {
+        printf("SUCCESS");
+    } else {
+        printf("FAILED to connect\n");
+        return EXIT_FAILURE;
+    }
+
+    startupPhase("room joined");
 
     SONOS::Status status(gPlayer);
-    status.get_mac(gMac);
+    SONOS::VolumeSync* volume = 0;
+    if (!getCmd(argc, argv, "--no-volume-sync")) {
+        volume = new SONOS::VolumeSync(gPlayer);
+        volume->setGroup(zone->size() > 1);
+    }
+    status.setGroup(zone->size() > 1);
+    if (!cachedMac) {
+        status.get_mac(gMac); // otherwise slimproto keeps the cached MAC, so LMS sees the same player
+        macKnown.set_value();
+        startupPhase("MAC known");
+    }
     printf(" (MAC = %02X:%02X:%02X:%02X:%02X:%02X)\n\n", gMac[0], gMac[1], gMac[2], gMac[3], gMac[4], gMac[5]);
 
-    std::thread* t = 0;
+    SONOS::Topology current(gSonos);
+    if (current != cached && !current.save(cacheFile)) {
+        printf("Unable to write %s\n", cacheFile.c_str());
+    }
+    if (cachedCoordinator) {
+        std::thread(rediscover_thread, cacheFile, current).detach();
+    }
+
     if (filename) {
         std::string fn(filename);
         std::string extension("none");
@@ -204,33 +507,70 @@ int main(int argc, char** argv)
         } else {
             printf("Failed to start URL %s\n", url.c_str());
         }
-    } else {
-        std::string name = "SONOS::" + std::string(room);
-        t = new std::thread(squeezelite_thread, server, name);
     }
 
-    unsigned current_stream_id = 0;
+    if (handover) {
+        std::string controller = gPlayer->GetControllerUri();
+        if (SONOS::SBHandover::listen(handover, atoi(controller.substr(controller.rfind(':') + 1).c_str()))) {
+            signal(SIGUSR2, handleReexec);
+        }
+    }
+
+    unsigned current_stream_id = get_squeezebox_stream_id(); // a stream taken over is playing already
+    bool first_audio = false;
+    SONOS::SBWatchdog watchdog;
     unsigned time_count = 0;
 
+    // last, so the threads started above do not inherit the policy of the main loop
+    sbsched_apply(SBR_MAIN);
+
     status.update();
 
     for (;;) {
         unsigned stream_id = get_squeezebox_stream_id();
         if (stream_id != current_stream_id) {
             current_stream_id = stream_id;
+            uint64_t t_play = sbtrace_begin();
+            sbmetrics_start_phase(SBP_PLAY_REQUEST, stream_id);
             PlaySqueezeBox(stream_id);
+            sbmetrics_start_phase(SBP_PLAY_REPLY, stream_id);
+            sbtrace_end(SBS_PLAYSTREAM, stream_id, t_play, 0);
+            if (!first_audio) {
+                first_audio = true;
+                startupPhase("first PlayStream");
+                printStartup();
+            }
+        }
+        if (watchdog.check(stream_id, sbtrace_now_us() / 1000)) {
+            restart_squeezebox_stream(); // picked up as a new stream id on the next iteration
+        }
+        if (gReexec) {
+            gReexec = 0;
+            printf("Starting a new process to hand over to\n");
+            SONOS::SBHandover::reexec(argv);
+        }
+        if (gTopologyEvent) {
+            gTopologyEvent = false;
+            followRoom(room, status, volume);
+        }
+        if (gTopologyChanged) {
+            gTopologyChanged = false;
+            reconcileTopology(room, status, volume);
         }
-        if ((time_count == 3000) || gEvent) {
+        if ((time_count == 3000) || gEvent || status.pending()) {
             gEvent = false;
             status.update();
             if (status.changed()) {
+                if (volume) {
+                    volume->reported(status.volume());
+                }
                 status.print();
             }
             time_count = 0;
         } else {
             ++time_count;
         }
-        usleep(10000); // 10ms
+        sbsched_sleep_us(SBR_MAIN, 10000); // 10ms
     }
 
     if (t) {
@@ -245,6 +585,18 @@ static void handleEvent(void* handle)
     gEvent = true;
 }
 
+static void handleTopologyEvent(void* handle)
+{
+    gTopologyEvent = true;
+    gEvent = true;
+}
+
+static void handleReexec(int signum)
+{
+    (void)signum;
+    gReexec = 1;
+}
+
 static const char* getCmd(int argc, char** argv, const std::string& option)
 {
     char** end = argv + argc;
@@ -18,58 +18,254 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "sonos-status.h"
+#include "sonos-topology.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#define STATUS_REFRESH_S 30 // position is re-queried this often while playing, to correct drift
 
 using namespace NSROOT;
 
+static uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int parse_reltime(const std::string& reltime)
+{
+    unsigned h, m, s;
+    if (sscanf(reltime.c_str(), "%u:%u:%u", &h, &m, &s) == 3) {
+        return h * 3600 + m * 60 + s;
+    }
+    return -2; // NOT_IMPLEMENTED and the like
+}
+
 Status::Status(PlayerPtr player)
-    : m_player(player)
-    , m_title("")
+    : m_title("")
     , m_album("")
     , m_artist("")
     , m_transport_status("")
     , m_transport_state("")
     , m_volume(0)
-    , m_reltime("")
     , m_current_track_duration("")
-    , m_last_hash(0)
+    , m_position_s(-1)
+    , m_position_ms(0)
+    , m_dirty(0)
+    , m_running(true)
+    , m_playing(false)
+    , m_query_volume(false)
+    , m_query_position(false)
+    , m_group(false)
+    , m_generation(0)
+    , m_volume_result(-1)
+    , m_position_result(-1)
+    , m_position_result_ms(0)
+    , m_pending(false)
 {
+    rebind(player);
+    m_thread = std::thread(&Status::worker, this);
+}
+
+Status::~Status()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+}
+
+void Status::rebind(PlayerPtr player)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_player = player;
+    m_soap = SoapPool::get(m_player->GetHost(), m_player->GetPort());
     m_uuid = m_player->GetZone()->GetCoordinator()->GetUUID();
     m_name = m_player->GetZone()->GetZoneName();
+    ++m_generation;
+    m_volume_result = -1;
+    m_position_result = -1;
+    m_position_s = -1;
+    m_query_volume = true;
+    m_query_position = true;
+    m_dirty = ~0u;
+    m_cond.notify_all();
+}
+
+void Status::setGroup(bool group)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (group != m_group) {
+        m_group = group;
+        ++m_generation; // a volume in flight is the one of the other kind
+        m_volume_result = -1;
+        m_query_volume = group; // a single player's volume comes with its events
+        m_cond.notify_all();
+    }
+}
+
+// The master volume noson has parsed from the coordinator's RenderingControl events, -1 before
+// the first event. A group's volume is not evented per player, so it is not looked up.
+int Status::eventVolume()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_group) {
+            return -1;
+        }
+    }
+    if (m_player->RenderingPropertyEmpty()) {
+        return -1;
+    }
+    SONOS::SRPList props = m_player->GetRenderingProperty();
+    for (const SONOS::SubordinateRC& rc : props) {
+        if (rc.uuid == m_uuid) {
+            return rc.property.VolumeMaster;
+        }
+    }
+    return -1;
+}
+
+void Status::set(std::string& field, const std::string& value, unsigned flag)
+{
+    if (field != value) {
+        field = value;
+        m_dirty |= flag;
+    }
+}
+
+void Status::query(bool volume, bool position)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_query_volume |= volume;
+    m_query_position |= position;
+    m_playing = m_transport_state == "PLAYING";
+    m_cond.notify_all();
 }
 
+// Cheap enough to call on every event: reads the event-driven transport properties and whatever
+// the worker has fetched since the last call.
 void Status::update()
 {
+    m_pending = false;
     if (m_player && !m_player->TransportPropertyEmpty()) {
-        if (!m_player->GetVolume(m_uuid, &m_volume)) {
-            m_volume = 0;
-        }
         SONOS::AVTProperty props = m_player->GetTransportProperty();
-        SONOS::ElementList vars;
-        if (m_player->GetPositionInfo(vars)) {
-            m_reltime = vars.GetValue("RelTime");
-        } else {
-            m_reltime = "-:--:--";
-        }
+        unsigned before = m_dirty;
         if (props.CurrentTrackMetaData) {
-            m_title = props.CurrentTrackMetaData->GetValue("dc:title");
-            m_album = props.CurrentTrackMetaData->GetValue("upnp:album");
-            m_artist = props.CurrentTrackMetaData->GetValue("dc:creator");
+            set(m_title, props.CurrentTrackMetaData->GetValue("dc:title"), TITLE);
+            set(m_album, props.CurrentTrackMetaData->GetValue("upnp:album"), ALBUM);
+            set(m_artist, props.CurrentTrackMetaData->GetValue("dc:creator"), ARTIST);
+        }
+        set(m_transport_status, props.TransportStatus, TRANSPORT_STATUS);
+        set(m_transport_state, props.TransportState, TRANSPORT_STATE);
+        set(m_current_track_duration, props.CurrentTrackDuration, DURATION);
+        // the volume is only queried when the events don't carry it; the position when the track
+        // or the transport state changed
+        int volume = eventVolume();
+        if (volume >= 0 && volume != m_volume) {
+            m_volume = volume;
+            m_dirty |= VOLUME;
         }
-        m_transport_status = props.TransportStatus;
-        m_transport_state = props.TransportState;
-        m_current_track_duration = props.CurrentTrackDuration;
+        query(volume < 0, (m_dirty & ~before & (TITLE | TRANSPORT_STATE | DURATION)) != 0);
     } else {
-        m_title = "";
-        m_album = "";
-        m_artist = "";
-        m_transport_status = "";
-        m_transport_state = "";
-        m_volume = 0;
-        m_reltime = "-:--:--";
-        m_current_track_duration = "-:--:--";
+        set(m_title, "", TITLE);
+        set(m_album, "", ALBUM);
+        set(m_artist, "", ARTIST);
+        set(m_transport_status, "", TRANSPORT_STATUS);
+        set(m_transport_state, "", TRANSPORT_STATE);
+        set(m_current_track_duration, "-:--:--", DURATION);
+        m_position_s = -1;
+        if (m_volume) {
+            m_volume = 0;
+            m_dirty |= VOLUME;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_volume_result >= 0) {
+        if (m_volume != m_volume_result) {
+            m_volume = m_volume_result;
+            m_dirty |= VOLUME;
+        }
+        m_volume_result = -1;
+    }
+    if (m_position_result != -1) {
+        m_position_s = m_position_result < 0 ? -1 : m_position_result;
+        m_position_ms = m_position_result_ms;
+        m_position_result = -1;
+        m_dirty |= POSITION;
+    }
+}
+
+void Status::worker()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        bool timeout = !m_cond.wait_for(lock, std::chrono::seconds(STATUS_REFRESH_S),
+            [this]() { return !m_running || m_query_volume || m_query_position; });
+        if (!m_running) {
+            break;
+        }
+        if (timeout) {
+            if (!m_playing) {
+                continue;
+            }
+            m_query_position = true;
+        }
+        std::shared_ptr<SoapPool> soap = m_soap;
+        unsigned generation = m_generation;
+        bool volume = m_query_volume;
+        bool position = m_query_position;
+        bool group = m_group;
+        m_query_volume = false;
+        m_query_position = false;
+        lock.unlock();
+
+        SoapCall getVolume = group ? SoapCall("GroupRenderingControl", "GetGroupVolume", "<InstanceID>0</InstanceID>")
+                                   : SoapCall("RenderingControl", "GetVolume", "<InstanceID>0</InstanceID><Channel>Master</Channel>");
+        SoapCall getPosition("AVTransport", "GetPositionInfo", "<InstanceID>0</InstanceID>");
+        std::vector<SoapCall*> calls;
+        if (volume) {
+            calls.push_back(&getVolume);
+        }
+        if (position) {
+            calls.push_back(&getPosition);
+        }
+        soap->call(calls);
+        uint64_t ms = now_ms();
+
+        lock.lock();
+        if (generation != m_generation) {
+            continue;
+        }
+        if (volume && getVolume.ok) { // a failed query leaves -1, the volume shown is kept
+            m_volume_result = atoi(getVolume.value("CurrentVolume").c_str());
+        }
+        if (position) {
+            m_position_result = getPosition.ok ? parse_reltime(getPosition.value("RelTime")) : -2;
+            m_position_result_ms = ms;
+        }
+        m_pending = true;
     }
 }
 
+std::string Status::reltime() const
+{
+    if (m_position_s < 0) {
+        return "-:--:--";
+    }
+    unsigned s = m_position_s;
+    if (m_transport_state == "PLAYING") {
+        s += (now_ms() - m_position_ms) / 1000;
+    }
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u:%02u:%02u", s / 3600, s / 60 % 60, s % 60);
+    return buf;
+}
+
 void Status::print()
 {
     std::string row("---------------------------------------------------------------------------------------------");
@@ -86,36 +282,19 @@ void Status::print()
         m_transport_status.c_str(),
         m_transport_state.c_str(),
         m_volume,
-        m_reltime.c_str(),
+        reltime().c_str(),
         m_current_track_duration.c_str());
     printf("+%s+\n", row.c_str());
 }
 
-size_t Status::hash()
-{
-    size_t h = std::hash<std::string> {}(m_title);
-    h += std::hash<std::string> {}(m_album);
-    h += std::hash<std::string> {}(m_artist);
-    h += std::hash<std::string> {}(m_transport_status);
-    h += std::hash<std::string> {}(m_transport_state);
-    h += std::hash<std::string> {}(m_reltime);
-    h += std::hash<std::string> {}(m_current_track_duration);
-    return h + std::hash<uint8_t> {}(m_volume);
-}
-
 bool Status::changed()
 {
-    size_t h = hash();
-    bool c = h != m_last_hash;
-    m_last_hash = h;
+    bool c = m_dirty != 0;
+    m_dirty = 0;
     return c;
 }
 
 void Status::get_mac(uint8_t* mac)
 {
-    if (m_uuid.length() > 19) {
-        for (int i = 0; i < 6; ++i) {
-            mac[i] = strtoul(m_uuid.substr(7 + 2 * i, 2).c_str(), 0, 16);
-        }
-    }
+    Topology::mac(m_uuid, mac);
 }
@@ -20,22 +20,57 @@
 #ifndef SONOS_STATUS_H
 #define SONOS_STATUS_H
 
+#include "sonos-soap.h"
+
 #include <sonosplayer.h>
 #include <sonossystem.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 namespace NSROOT {
+
+// Now-playing state of the room. Transport state, track metadata and the volume of a single
+// player come from the properties noson keeps up to date from AVTransport and RenderingControl
+// events. The position, and the volume of a group (or of a player before its first event), need
+// SOAP queries, which a background worker performs (pipelined on a kept connection), so update()
+// never blocks the main loop. The position is interpolated locally between queries.
 class Status {
 public:
     Status(PlayerPtr player);
-    ~Status() {};
+    ~Status();
+    void rebind(PlayerPtr player);
+    void setGroup(bool group); // the zone has more than one player: its volume is the group's
     void update();
     bool changed();
+    bool pending() const { return m_pending; } // the worker has new results for update()
     void print();
-    size_t hash();
     void get_mac(uint8_t * mac);
+    const std::string& get_uuid() const { return m_uuid; }
+    int volume() const { return m_transport_state.empty() ? -1 : m_volume; } // -1 = unknown
 
 protected:
+    enum Field {
+        TITLE = 0x01,
+        ALBUM = 0x02,
+        ARTIST = 0x04,
+        TRANSPORT_STATUS = 0x08,
+        TRANSPORT_STATE = 0x10,
+        VOLUME = 0x20,
+        DURATION = 0x40,
+        POSITION = 0x80,
+    };
+
+    void set(std::string& field, const std::string& value, unsigned flag);
+    void query(bool volume, bool position);
+    int eventVolume();
+    void worker();
+    std::string reltime() const;
+
     PlayerPtr m_player;
+    std::shared_ptr<SoapPool> m_soap;
     std::string m_uuid;
     std::string m_name;
 
@@ -45,9 +80,25 @@ protected:
     std::string m_transport_status;
     std::string m_transport_state;
     uint8_t m_volume;
-    std::string m_reltime;
     std::string m_current_track_duration;
-    size_t m_last_hash;
+    int m_position_s; // -1 = unknown
+    uint64_t m_position_ms; // when the position was m_position_s
+    unsigned m_dirty;
+
+    // shared with the worker, under m_mutex
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_running;
+    bool m_playing;
+    bool m_query_volume;
+    bool m_query_position;
+    bool m_group;
+    unsigned m_generation; // bumped on rebind, results for an older player are dropped
+    int m_volume_result; // -1 = none
+    int m_position_result; // -1 = none, -2 = unknown
+    uint64_t m_position_result_ms;
+    std::atomic<bool> m_pending;
+    std::thread m_thread;
 };
 }
 
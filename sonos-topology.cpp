@@ -0,0 +1,165 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "sonos-topology.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#define TOPOLOGY_HEADER "# sonos-squeezebox topology cache"
+
+using namespace NSROOT;
+
+Topology::Topology(System* system)
+{
+    ZonePlayerList players = system->GetZonePlayerList();
+    for (ZonePlayerList::const_iterator it = players.begin(); it != players.end(); ++it) {
+        m_players.push_back({ it->first, it->second->GetUUID(), it->second->GetHost(), it->second->GetPort() });
+    }
+    ZoneList zones = system->GetZoneList();
+    for (ZoneList::const_iterator it = zones.begin(); it != zones.end(); ++it) {
+        Zone zone { it->second->GetZoneName(), it->second->GetCoordinator()->GetUUID(), {} };
+        for (const ZonePlayerPtr& member : *it->second) {
+            zone.members.push_back(*member);
+        }
+        std::sort(zone.members.begin(), zone.members.end());
+        m_zones.push_back(zone);
+    }
+    std::sort(m_players.begin(), m_players.end(), [](const Player& a, const Player& b) { return a.uuid < b.uuid; });
+    std::sort(m_zones.begin(), m_zones.end(), [](const Zone& a, const Zone& b) { return a.name < b.name; });
+}
+
+// one line per player or zone, fields separated by tabs, the name last:
+//   player <uuid> <host> <port> <name>
+//   zone <coordinator uuid> <name> [<member name> ...]
+bool Topology::load(const std::string& filename)
+{
+    std::ifstream in(filename);
+    std::string line;
+    if (!std::getline(in, line) || line != TOPOLOGY_HEADER) {
+        return false;
+    }
+    m_players.clear();
+    m_zones.clear();
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, '\t')) {
+            fields.push_back(field);
+        }
+        if (fields.size() == 5 && fields[0] == "player") {
+            m_players.push_back({ fields[4], fields[1], fields[2], (unsigned)atoi(fields[3].c_str()) });
+        } else if (fields.size() >= 3 && fields[0] == "zone") {
+            m_zones.push_back({ fields[2], fields[1], std::vector<std::string>(fields.begin() + 3, fields.end()) });
+        }
+    }
+    return !empty();
+}
+
+bool Topology::save(const std::string& filename) const
+{
+    // several instances (one per room) may share the file, so replace it atomically
+    std::string tmp = filename + "." + std::to_string(getpid());
+    {
+        std::ofstream out(tmp);
+        out << TOPOLOGY_HEADER << "\n";
+        for (const Player& p : m_players) {
+            out << "player\t" << p.uuid << "\t" << p.host << "\t" << p.port << "\t" << p.name << "\n";
+        }
+        for (const Zone& z : m_zones) {
+            out << "zone\t" << z.coordinator << "\t" << z.name;
+            for (const std::string& member : z.members) {
+                out << "\t" << member;
+            }
+            out << "\n";
+        }
+        if (!out.good()) {
+            out.close();
+            unlink(tmp.c_str());
+            return false;
+        }
+    }
+    return rename(tmp.c_str(), filename.c_str()) == 0;
+}
+
+bool Topology::operator==(const Topology& other) const
+{
+    if (m_players.size() != other.m_players.size() || m_zones.size() != other.m_zones.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < m_players.size(); ++i) {
+        const Player& a = m_players[i];
+        const Player& b = other.m_players[i];
+        if (a.uuid != b.uuid || a.host != b.host || a.port != b.port || a.name != b.name) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < m_zones.size(); ++i) {
+        const Zone& a = m_zones[i];
+        const Zone& b = other.m_zones[i];
+        if (a.name != b.name || a.coordinator != b.coordinator || a.members != b.members) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const Topology::Player* Topology::coordinator(const std::string& room) const
+{
+    const Zone* zone = nullptr;
+    for (const Zone& z : m_zones) {
+        if (z.name == room) {
+            zone = &z;
+        }
+    }
+    for (const Zone& z : m_zones) {
+        if (!zone && std::find(z.members.begin(), z.members.end(), room) != z.members.end()) {
+            zone = &z;
+        }
+    }
+    if (zone) {
+        for (const Player& p : m_players) {
+            if (p.uuid == zone->coordinator) {
+                return &p;
+            }
+        }
+    }
+    return nullptr;
+}
+
+std::string Topology::defaultFile()
+{
+    const char* home = getenv("HOME");
+    return std::string(home ? home : "/tmp") + "/.sonos-squeezebox.cache";
+}
+
+void Topology::mac(const std::string& uuid, uint8_t* mac)
+{
+    if (uuid.length() > 19) {
+        for (int i = 0; i < 6; ++i) {
+            mac[i] = strtoul(uuid.substr(7 + 2 * i, 2).c_str(), 0, 16);
+        }
+    }
+}
@@ -0,0 +1,69 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SONOS_TOPOLOGY_H
+#define SONOS_TOPOLOGY_H
+
+#include <sonossystem.h>
+
+#include <string>
+#include <vector>
+
+namespace NSROOT {
+
+// Snapshot of the players and zones of a Sonos household, persisted between runs so a restart
+// can connect to the coordinator of its room without waiting for SSDP discovery.
+class Topology {
+public:
+    struct Player {
+        std::string name;
+        std::string uuid;
+        std::string host;
+        unsigned port;
+    };
+    struct Zone {
+        std::string name;
+        std::string coordinator; // uuid
+        std::vector<std::string> members; // player names
+    };
+
+    Topology() {}
+    explicit Topology(System* system);
+
+    bool load(const std::string& filename);
+    bool save(const std::string& filename) const;
+    bool empty() const { return m_players.empty(); }
+    bool operator==(const Topology& other) const;
+    bool operator!=(const Topology& other) const { return !(*this == other); }
+
+    const Player* coordinator(const std::string& room) const; // of the zone named room, or having it as member
+    const std::vector<Player>& players() const { return m_players; }
+    const std::vector<Zone>& zones() const { return m_zones; }
+
+    static std::string defaultFile();
+    static void mac(const std::string& uuid, uint8_t* mac); // RINCON_xxxxxxxxxxxx01400
+
+private:
+    std::vector<Player> m_players;
+    std::vector<Zone> m_zones;
+};
+}
+
+#endif /* SONOS_TOPOLOGY_H */
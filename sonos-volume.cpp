@@ -0,0 +1,154 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "sonos-volume.h"
+#include "sbmetrics.h"
+#include "sbtrace.h"
+
+#include <atomic>
+#include <cmath>
+
+// LMS maps volume 1-100 linearly onto -50 to 0 dB (getVolumeParameters of Squeezebox2.pm)
+#define VOLUME_RANGE_DB 50.0
+#define VOLUME_GAIN_ONE 0x10000 // FIXED_ONE
+
+using namespace NSROOT;
+
+static std::atomic<VolumeSync*> g_volume { nullptr };
+
+extern "C" {
+// squeezelite set_volume(): returns at once, the worker talks to Sonos
+void sync_squeezebox_volume(unsigned left, unsigned right)
+{
+    VolumeSync* volume = g_volume.load();
+    if (volume) {
+        volume->request(VolumeSync::fromGain(left > right ? left : right));
+    }
+}
+} // extern "C"
+
+VolumeSync::VolumeSync(PlayerPtr player)
+    : m_running(true)
+    , m_group(false)
+    , m_target(-1)
+    , m_lms(-1)
+    , m_sonos(-1)
+    , m_busy(false)
+{
+    rebind(player);
+    m_thread = std::thread(&VolumeSync::worker, this);
+    g_volume.store(this);
+}
+
+VolumeSync::~VolumeSync()
+{
+    g_volume.store(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+}
+
+void VolumeSync::rebind(PlayerPtr player)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_soap = SoapPool::get(player->GetHost(), player->GetPort());
+    m_sonos = -1;
+}
+
+void VolumeSync::setGroup(bool group)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (group != m_group) {
+        m_group = group;
+        m_sonos = -1; // the volume of the player is not that of the group
+    }
+}
+
+unsigned VolumeSync::fromGain(unsigned gain)
+{
+    if (!gain) {
+        return 0;
+    }
+    double db = 20.0 * log10((double)gain / VOLUME_GAIN_ONE);
+    long volume = lround(100.0 + db * 101.0 / VOLUME_RANGE_DB);
+    return volume < 1 ? 1 : volume > 100 ? 100 : (unsigned)volume;
+}
+
+void VolumeSync::request(unsigned volume)
+{
+    sbmetrics_add(SBM_VOLUME_UPDATES, 1);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if ((int)volume == m_lms) {
+        return; // repeated by LMS, Sonos may have been changed since
+    }
+    m_lms = volume;
+    m_target = volume;
+    m_cond.notify_all();
+}
+
+void VolumeSync::reported(int volume)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_busy && m_target < 0) {
+        m_sonos = volume; // while sending, the report may predate the new volume
+    }
+}
+
+void VolumeSync::worker()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        m_cond.wait(lock, [this]() { return !m_running || m_target >= 0; });
+        if (!m_running) {
+            break;
+        }
+        int volume = m_target;
+        m_target = -1;
+        if (volume == m_sonos) {
+            continue;
+        }
+        std::shared_ptr<SoapPool> soap = m_soap;
+        bool group = m_group;
+        m_busy = true;
+        lock.unlock();
+
+        uint64_t t = sbtrace_begin();
+        SoapCall setVolume = group
+            ? SoapCall("GroupRenderingControl", "SetGroupVolume",
+                "<InstanceID>0</InstanceID><DesiredVolume>" + std::to_string(volume) + "</DesiredVolume>")
+            : SoapCall("RenderingControl", "SetVolume",
+                "<InstanceID>0</InstanceID><Channel>Master</Channel><DesiredVolume>" + std::to_string(volume) + "</DesiredVolume>");
+        bool ok = soap->call(setVolume);
+        sbtrace_end(SBS_SET_VOLUME, 0, t, volume);
+        sbmetrics_add(SBM_VOLUME_SETS, 1);
+        if (!ok) {
+            sbtrace(SBT_VOLUME_FAILED, 0, volume, 0);
+        }
+
+        lock.lock();
+        m_busy = false;
+        if (soap == m_soap && group == m_group) {
+            m_sonos = ok ? volume : -1;
+        }
+    }
+}
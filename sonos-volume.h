@@ -0,0 +1,70 @@
+// SONOS::Squeezebox -- deploy Sonos in a Logitech Media Server (LMS) streaming environment
+//
+// Copyright (c) 2023 Martin van der Werff <github (at) newinnovations.nl>
+//
+// This file is part of SONOS::Squeezebox.
+//
+// SONOS::Squeezebox is free software: you can redistribute it and/or modify it under the terms of
+// the GNU General Public License as published by the Free Software Foundation, either version 3
+// of the License, or (at your option) any later version.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SONOS_VOLUME_H
+#define SONOS_VOLUME_H
+
+#include "sonos-soap.h"
+
+#include <sonosplayer.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace NSROOT {
+
+// Passes the LMS volume on to Sonos. request() is called from squeezelite and only records the
+// latest value; a worker sends it with one SetVolume at a time, so a dragged slider results in a
+// few SOAP requests instead of dozens and squeezelite never waits for the network. LMS repeats its
+// volume when a track starts and Sonos reports every change in an event: values Sonos already
+// has are not sent again, so a volume changed in the Sonos app is not overridden by these echoes.
+// When the room is grouped with others, SetGroupVolume on the coordinator sets the volume of the
+// whole group (Sonos keeps the members' volumes relative to each other); SetVolume would only
+// change the coordinator.
+class VolumeSync {
+public:
+    VolumeSync(PlayerPtr player);
+    ~VolumeSync();
+    void rebind(PlayerPtr player);
+    void setGroup(bool group); // the zone has more than one player
+    void request(unsigned volume); // 0-100, from LMS
+    void reported(int volume); // 0-100 as last seen on Sonos, -1 = unknown
+
+    // squeezelite gain (16.16) to the LMS volume it came from
+    static unsigned fromGain(unsigned gain);
+
+private:
+    void worker();
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_running;
+    std::shared_ptr<SoapPool> m_soap; // of the coordinator
+    bool m_group;
+    int m_target; // -1 = nothing to send
+    int m_lms; // last volume from LMS, -1 = none yet
+    int m_sonos; // volume Sonos has, -1 = unknown
+    bool m_busy; // a SetVolume is in flight
+    std::thread m_thread;
+};
+}
+
+#endif /* SONOS_VOLUME_H */
@@ -22,7 +22,18 @@ extern "C" {
 #include "output_sonos.h"
 }
 
+#include "sbbudget.h"
+#include "sbmetrics.h"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <poll.h>
 #include <signal.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define SLIMPROTO_PORT 3483
 
 static void sighandler(int signum)
 {
@@ -30,7 +41,7 @@ static void sighandler(int signum)
     signal(signum, SIG_DFL); // second signal will cause non gracefull shutdown
 }
 
-void squeezelite(const char* server, uint8_t * mac, const char* name)
+void squeezelite_init(void)
 {
     unsigned rates[MAX_SUPPORTED_SAMPLERATES] = { 0 };
 
@@ -39,10 +50,54 @@ void squeezelite(const char* server, uint8_t * mac, const char* name)
     signal(SIGQUIT, sighandler);
     signal(SIGHUP, sighandler);
 
-    output_init_sonos(lWARN, OUTPUTBUF_SIZE, 0 /*output_params*/, rates, 0 /*rate_delay*/);
+    const struct sbbudget* budget = sbbudget_get();
+    output_init_sonos(lWARN, budget->outputbuf_size ? budget->outputbuf_size : OUTPUTBUF_SIZE, 0 /*output_params*/, rates, 0 /*rate_delay*/);
     decode_init(lWARN, 0 /*include_codecs,*/, "" /*exclude_codecs*/);
-    stream_init(lWARN, STREAMBUF_SIZE);
+    stream_init(lWARN, budget->streambuf_size ? budget->streambuf_size : STREAMBUF_SIZE);
+    sbmetrics_set(SBM_BUFFER_BYTES, streambuf->size + outputbuf->size);
+}
+
+// Same broadcast as slimproto's own discovery, but usable before the player MAC is known. One
+// round of at most timeout_ms; empty when no server answered.
+std::string squeezelite_discover(int timeout_ms)
+{
+    char buf[32];
+    int len = sprintf(buf, "e%s%c%s", "JSON", '\0', "CLIP") + 1;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("squeezelite_discover: socket");
+        return "";
+    }
+    int enable = 1;
+    setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
 
+    struct sockaddr_in d;
+    memset(&d, 0, sizeof(d));
+    d.sin_family = AF_INET;
+    d.sin_port = htons(SLIMPROTO_PORT);
+    d.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+
+    struct sockaddr_in s;
+    memset(&s, 0, sizeof(s));
+    struct pollfd pollinfo = { sock, POLLIN, 0 };
+    if (sendto(sock, buf, len, 0, (struct sockaddr*)&d, sizeof(d)) < 0) {
+        perror("squeezelite_discover: sendto");
+    } else if (poll(&pollinfo, 1, timeout_ms) == 1) {
+        char readbuf[32];
+        socklen_t slen = sizeof(s);
+        recvfrom(sock, readbuf, sizeof(readbuf), 0, (struct sockaddr*)&s, &slen);
+    }
+    close(sock);
+
+    if (s.sin_addr.s_addr == 0) {
+        return "";
+    }
+    return std::string(inet_ntoa(s.sin_addr)) + ":" + std::to_string(ntohs(s.sin_port));
+}
+
+void squeezelite_run(const char* server, uint8_t* mac, const char* name)
+{
     slimproto(lWARN, (char*)server, mac, name, 0 /*namefile*/, 0 /*modelname*/, 0 /*maxSampleRate*/);
 
     stream_close();